@@ -174,6 +174,9 @@ struct _MetaDrawOp
       MetaImageFillType fill_type;
       unsigned int vertical_stripes : 1;
       unsigned int horizontal_stripes : 1;
+
+      /* Scaled surfaces of this image that are still in the cache */
+      GList *surfaces;
     } image;
 
     struct {
@@ -259,7 +262,7 @@ G_GNUC_INTERNAL
 void            meta_draw_op_list_unref           (MetaDrawOpList        *op_list);
 
 G_GNUC_INTERNAL
-void            meta_draw_op_list_draw_with_style (const MetaDrawOpList  *op_list,
+void            meta_draw_op_list_draw_with_style (MetaDrawOpList        *op_list,
                                                    GtkStyleContext       *context,
                                                    cairo_t               *cr,
                                                    const MetaDrawInfo    *info,
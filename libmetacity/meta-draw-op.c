@@ -20,8 +20,10 @@
 
 #include <glib/gi18n-lib.h>
 #include <math.h>
+#include <string.h>
 
 #include "meta-draw-op-private.h"
+#include "meta-theme-impl-private.h"
 
 #define GDK_COLOR_RGB(color)                             \
         ((guint32) (((int)((color).red * 255) << 16)   | \
@@ -31,6 +33,57 @@
 #define CLAMP_UCHAR(v) ((guchar) (CLAMP (((int)v), (int)0, (int)255)))
 #define INTENSITY(r, g, b) ((r) * 0.30 + (g) * 0.59 + (b) * 0.11)
 
+/* How many recordings of each list are kept */
+#define MAX_RECORDINGS 4
+
+/* How much memory scaled image surfaces may use, shared by all image ops */
+#define MAX_IMAGE_SURFACES_SIZE (8 * 1024 * 1024)
+
+/**
+ * Everything that decides what drawing a list of operations results in.
+ * Compared bytewise, so it has to be cleared before it is filled in.
+ */
+typedef struct
+{
+  MetaPositionExprEnv  env;
+  GtkStyleContext     *context;
+  GdkPixbuf           *mini_icon;
+  GdkPixbuf           *icon;
+  PangoLayout         *title_layout;
+} MetaDrawOpListKey;
+
+/**
+ * The result of drawing a list of operations, which can be replayed
+ * as long as the key stays the same.
+ */
+typedef struct
+{
+  MetaDrawOpListKey  key;
+  cairo_surface_t   *surface;
+} MetaDrawOpListRecording;
+
+/**
+ * An image op scaled or tiled to a given size. Fill type and stripes
+ * are fixed for each op, so the op together with the size and the
+ * colorize pixel decides what the surface looks like.
+ */
+typedef struct
+{
+  MetaDrawOp      *op;
+  gdouble          width;
+  gdouble          height;
+  guint32          colorize_pixel;
+
+  cairo_surface_t *surface;
+  gsize            size;
+
+  GList            link;
+} MetaImageSurface;
+
+/* Most recently used first */
+static GQueue image_surfaces = G_QUEUE_INIT;
+static gsize image_surfaces_size = 0;
+
 /**
  * A list of MetaDrawOp objects. Maintains a reference count.
  * Grows as necessary and allows the allocation of unused spaces
@@ -45,8 +98,18 @@ struct _MetaDrawOpList
   MetaDrawOp **ops;
   int n_ops;
   int n_allocated;
+
+  /* Most recently used first */
+  MetaDrawOpListRecording recordings[MAX_RECORDINGS];
+  int n_recordings;
 };
 
+static void draw_op_list (const MetaDrawOpList *op_list,
+                          GtkStyleContext      *context,
+                          cairo_t              *cr,
+                          const MetaDrawInfo   *info,
+                          MetaRectangleDouble   rect);
+
 static void
 fill_env (MetaPositionExprEnv *env,
           const MetaDrawInfo  *info,
@@ -184,6 +247,80 @@ get_surface_from_pixbuf (GdkPixbuf         *pixbuf,
   return copy;
 }
 
+static void
+drop_image_surface (MetaImageSurface *image_surface)
+{
+  MetaDrawOp *op;
+
+  op = image_surface->op;
+  op->data.image.surfaces = g_list_remove (op->data.image.surfaces,
+                                           image_surface);
+
+  g_queue_unlink (&image_surfaces, &image_surface->link);
+  image_surfaces_size -= image_surface->size;
+
+  cairo_surface_destroy (image_surface->surface);
+  g_free (image_surface);
+}
+
+static cairo_surface_t *
+get_image_surface (MetaDrawOp *op,
+                   GdkPixbuf  *pixbuf,
+                   guint32     colorize_pixel,
+                   gdouble     width,
+                   gdouble     height)
+{
+  MetaImageSurface *image_surface;
+  GList *l;
+
+  for (l = op->data.image.surfaces; l != NULL; l = l->next)
+    {
+      image_surface = l->data;
+
+      if (image_surface->width == width &&
+          image_surface->height == height &&
+          image_surface->colorize_pixel == colorize_pixel)
+        {
+          g_queue_unlink (&image_surfaces, &image_surface->link);
+          g_queue_push_head_link (&image_surfaces, &image_surface->link);
+
+          return cairo_surface_reference (image_surface->surface);
+        }
+    }
+
+  image_surface = g_new0 (MetaImageSurface, 1);
+  image_surface->op = op;
+  image_surface->width = width;
+  image_surface->height = height;
+  image_surface->colorize_pixel = colorize_pixel;
+  image_surface->link.data = image_surface;
+
+  image_surface->surface = get_surface_from_pixbuf (pixbuf,
+                                                    op->data.image.fill_type,
+                                                    width, height,
+                                                    op->data.image.vertical_stripes,
+                                                    op->data.image.horizontal_stripes);
+
+  if (cairo_surface_get_type (image_surface->surface) == CAIRO_SURFACE_TYPE_IMAGE)
+    image_surface->size = cairo_image_surface_get_stride (image_surface->surface) *
+                          cairo_image_surface_get_height (image_surface->surface);
+  else
+    image_surface->size = ceil (width) * ceil (height) * 4;
+
+  op->data.image.surfaces = g_list_prepend (op->data.image.surfaces,
+                                            image_surface);
+
+  g_queue_push_head_link (&image_surfaces, &image_surface->link);
+  image_surfaces_size += image_surface->size;
+
+  /* Never evict the surface that is about to be drawn */
+  while (image_surfaces_size > MAX_IMAGE_SURFACES_SIZE &&
+         image_surfaces.length > 1)
+    drop_image_surface (image_surfaces.tail->data);
+
+  return cairo_surface_reference (image_surface->surface);
+}
+
 static GdkPixbuf *
 colorize_pixbuf (GdkPixbuf *orig,
                  GdkRGBA   *new_color)
@@ -300,20 +437,19 @@ draw_op_as_surface (const MetaDrawOp   *op,
 
             if (op->data.image.colorize_cache_pixbuf)
               {
-                surface = get_surface_from_pixbuf (op->data.image.colorize_cache_pixbuf,
-                                                   op->data.image.fill_type,
-                                                   width, height,
-                                                   op->data.image.vertical_stripes,
-                                                   op->data.image.horizontal_stripes);
+                /* const cast here */
+                surface = get_image_surface ((MetaDrawOp*)op,
+                                             op->data.image.colorize_cache_pixbuf,
+                                             op->data.image.colorize_cache_pixel,
+                                             width, height);
               }
           }
         else
           {
-            surface = get_surface_from_pixbuf (op->data.image.pixbuf,
-                                               op->data.image.fill_type,
-                                               width, height,
-                                               op->data.image.vertical_stripes,
-                                               op->data.image.horizontal_stripes);
+            /* const cast here */
+            surface = get_image_surface ((MetaDrawOp*)op,
+                                         op->data.image.pixbuf,
+                                         0, width, height);
           }
         break;
       }
@@ -718,6 +854,10 @@ draw_op_draw_with_env (const MetaDrawOp    *op,
           rx = meta_draw_spec_parse_x_position (op->data.title.x, env);
           ry = meta_draw_spec_parse_y_position (op->data.title.y, env);
 
+          /* Another op may have left the layout ellipsized */
+          if (!op->data.title.ellipsize_width)
+            pango_layout_set_width (info->title_layout, -1);
+
           if (op->data.title.ellipsize_width)
             {
               gdouble ellipsize_width;
@@ -727,9 +867,8 @@ draw_op_draw_with_env (const MetaDrawOp    *op,
               /* HACK: meta_draw_spec_parse_x_position adds in env->rect.x, subtract out again */
               ellipsize_width -= env->rect.x;
 
-              pango_layout_set_width (info->title_layout, -1);
-              pango_layout_get_pixel_extents (info->title_layout,
-                                              &ink_rect, &logical_rect);
+              get_title_layout_extents (info->title_layout,
+                                        &ink_rect, &logical_rect);
 
               /* Pango's idea of ellipsization is with respect to the logical rect.
                * correct for this, by reducing the ellipsization width by the overflow
@@ -745,10 +884,13 @@ draw_op_draw_with_env (const MetaDrawOp    *op,
 
               /* Only ellipsizing when necessary is a performance optimization -
                * pango_layout_set_width() will force a relayout if it isn't the
-               * same as the current width of -1.
+               * same as the current width. The layout is kept ellipsized
+               * after drawing, so redrawing it at the same width is free.
                */
               if (ellipsize_width < logical_rect.width)
                 pango_layout_set_width (info->title_layout, PANGO_SCALE * ellipsize_width);
+              else
+                pango_layout_set_width (info->title_layout, -1);
             }
           else if (rx - env->rect.x + env->title_width >= env->rect.width)
           {
@@ -779,10 +921,6 @@ draw_op_draw_with_env (const MetaDrawOp    *op,
 
           cairo_move_to (cr, rx, ry);
           pango_cairo_show_layout (cr, info->title_layout);
-
-          /* Remove any ellipsization we might have set; will short-circuit
-           * if the width is already -1 */
-          pango_layout_set_width (info->title_layout, -1);
         }
       break;
 
@@ -795,8 +933,7 @@ draw_op_draw_with_env (const MetaDrawOp    *op,
         d_rect.width = meta_draw_spec_parse_size (op->data.op_list.width, env);
         d_rect.height = meta_draw_spec_parse_size (op->data.op_list.height, env);
 
-        meta_draw_op_list_draw_with_style (op->data.op_list.op_list,
-                                           context, cr, info, d_rect);
+        draw_op_list (op->data.op_list.op_list, context, cr, info, d_rect);
       }
       break;
 
@@ -832,8 +969,7 @@ draw_op_draw_with_env (const MetaDrawOp    *op,
             tile.y = ry - tile_yoffset;
             while (tile.y < (ry + rheight))
               {
-                meta_draw_op_list_draw_with_style (op->data.tile.op_list,
-                                                   context, cr, info, tile);
+                draw_op_list (op->data.tile.op_list, context, cr, info, tile);
 
                 tile.y += tile.height;
               }
@@ -998,6 +1134,9 @@ meta_draw_op_free (MetaDrawOp *op)
         break;
 
       case META_DRAW_IMAGE:
+        while (op->data.image.surfaces != NULL)
+          drop_image_surface (op->data.image.surfaces->data);
+
         if (op->data.image.alpha_spec)
           meta_alpha_gradient_spec_free (op->data.image.alpha_spec);
 
@@ -1087,6 +1226,20 @@ meta_draw_op_free (MetaDrawOp *op)
   g_free (op);
 }
 
+static void
+recording_free (MetaDrawOpListRecording *recording)
+{
+  cairo_surface_destroy (recording->surface);
+
+  g_object_unref (recording->key.context);
+  if (recording->key.mini_icon)
+    g_object_unref (recording->key.mini_icon);
+  if (recording->key.icon)
+    g_object_unref (recording->key.icon);
+  if (recording->key.title_layout)
+    g_object_unref (recording->key.title_layout);
+}
+
 MetaDrawOpList *
 meta_draw_op_list_new (int n_preallocs)
 {
@@ -1100,6 +1253,7 @@ meta_draw_op_list_new (int n_preallocs)
   op_list->n_allocated = n_preallocs;
   op_list->ops = g_new (MetaDrawOp*, op_list->n_allocated);
   op_list->n_ops = 0;
+  op_list->n_recordings = 0;
 
   return op_list;
 }
@@ -1129,16 +1283,19 @@ meta_draw_op_list_unref (MetaDrawOpList *op_list)
 
       g_free (op_list->ops);
 
+      for (i = 0; i < op_list->n_recordings; i++)
+        recording_free (&op_list->recordings[i]);
+
       g_free (op_list);
     }
 }
 
-void
-meta_draw_op_list_draw_with_style (const MetaDrawOpList *op_list,
-                                   GtkStyleContext      *context,
-                                   cairo_t              *cr,
-                                   const MetaDrawInfo   *info,
-                                   MetaRectangleDouble   rect)
+static void
+draw_op_list (const MetaDrawOpList *op_list,
+              GtkStyleContext      *context,
+              cairo_t              *cr,
+              const MetaDrawInfo   *info,
+              MetaRectangleDouble   rect)
 {
   int i;
   MetaPositionExprEnv env;
@@ -1173,6 +1330,76 @@ meta_draw_op_list_draw_with_style (const MetaDrawOpList *op_list,
   cairo_restore (cr);
 }
 
+/**
+ * Draws a list of operations. The result is recorded, so that drawing
+ * the list again in the same geometry, with the same title and icons,
+ * only replays the recording instead of evaluating every operation.
+ * This is the case for most of a frame when only a button changes
+ * state.
+ */
+void
+meta_draw_op_list_draw_with_style (MetaDrawOpList       *op_list,
+                                   GtkStyleContext      *context,
+                                   cairo_t              *cr,
+                                   const MetaDrawInfo   *info,
+                                   MetaRectangleDouble   rect)
+{
+  MetaDrawOpListKey key;
+  MetaDrawOpListRecording recording;
+  cairo_t *recording_cr;
+  int i;
+
+  memset (&key, 0, sizeof (key));
+  fill_env (&key.env, info, rect);
+  key.context = context;
+  key.mini_icon = info->mini_icon;
+  key.icon = info->icon;
+  key.title_layout = info->title_layout;
+
+  for (i = 0; i < op_list->n_recordings; i++)
+    if (memcmp (&op_list->recordings[i].key, &key, sizeof (key)) == 0)
+      break;
+
+  if (i < op_list->n_recordings)
+    {
+      recording = op_list->recordings[i];
+    }
+  else
+    {
+      recording.key = key;
+      recording.surface =
+        cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA, NULL);
+
+      /* The key doesn't own these; keep them alive so their addresses
+       * can't be reused by something else while the recording exists
+       */
+      g_object_ref (context);
+      if (info->mini_icon)
+        g_object_ref (info->mini_icon);
+      if (info->icon)
+        g_object_ref (info->icon);
+      if (info->title_layout)
+        g_object_ref (info->title_layout);
+
+      recording_cr = cairo_create (recording.surface);
+      draw_op_list (op_list, context, recording_cr, info, rect);
+      cairo_destroy (recording_cr);
+
+      if (op_list->n_recordings == MAX_RECORDINGS)
+        recording_free (&op_list->recordings[--op_list->n_recordings]);
+
+      i = op_list->n_recordings++;
+    }
+
+  /* Keep the most recently used recordings at the front */
+  memmove (&op_list->recordings[1], &op_list->recordings[0],
+           i * sizeof (MetaDrawOpListRecording));
+  op_list->recordings[0] = recording;
+
+  cairo_set_source_surface (cr, recording.surface, 0, 0);
+  cairo_paint (cr);
+}
+
 void
 meta_draw_op_list_append (MetaDrawOpList *op_list,
                           MetaDrawOp     *op)
@@ -73,71 +73,131 @@ typedef struct
 
     struct {
       char *name;
-      GQuark name_quark;
     } v;
 
   } d;
 } PosToken;
 
 /**
- * A computed expression in our simple vector drawing language.
- * While it appears to take the form of a tree, this is actually
- * merely a list; concerns such as precedence of operators are
- * currently recomputed on every recalculation.
+ * The type of a PosExpr: either integer or double.
+ * \ingroup parser
+ */
+typedef enum
+{
+  POS_EXPR_INT,
+  POS_EXPR_DOUBLE
+} PosExprType;
+
+/**
+ * Type and value of an intermediate result while evaluating an
+ * expression.
  *
- * Created by meta_draw_spec_new(), destroyed by meta_draw_spec_free().
- * pos_eval() fills this with ...FIXME. Are tokens a tree or a list?
  * \ingroup parser
  */
-struct _MetaDrawSpec
+typedef struct
 {
-  /**
-   * If this spec is constant, this is the value of the constant;
-   * otherwise it is zero.
-   */
-  gdouble value;
+  PosExprType type;
+  union
+  {
+    double double_val;
+    int int_val;
+  } d;
+} PosExpr;
 
-  /** A list of tokens in the expression. */
-  PosToken *tokens;
+/**
+ * A variable which can appear in an expression, and where its value
+ * is found in a MetaPositionExprEnv.
+ *
+ * \ingroup parser
+ */
+typedef struct
+{
+  const char *name;
+  gsize       offset;
 
-  /** How many tokens are in the tokens list. */
-  int n_tokens;
+  /** Only defined if the value is not negative */
+  gboolean    optional;
+} PosVariable;
 
-  /** Does the expression contain any variables? */
-  gboolean constant : 1;
+static const PosVariable pos_variables[] =
+{
+  { "width", G_STRUCT_OFFSET (MetaPositionExprEnv, rect.width), FALSE },
+  { "height", G_STRUCT_OFFSET (MetaPositionExprEnv, rect.height), FALSE },
+  { "object_width", G_STRUCT_OFFSET (MetaPositionExprEnv, object_width), TRUE },
+  { "object_height", G_STRUCT_OFFSET (MetaPositionExprEnv, object_height), TRUE },
+  { "left_width", G_STRUCT_OFFSET (MetaPositionExprEnv, left_width), FALSE },
+  { "right_width", G_STRUCT_OFFSET (MetaPositionExprEnv, right_width), FALSE },
+  { "top_height", G_STRUCT_OFFSET (MetaPositionExprEnv, top_height), FALSE },
+  { "bottom_height", G_STRUCT_OFFSET (MetaPositionExprEnv, bottom_height), FALSE },
+  { "mini_icon_width", G_STRUCT_OFFSET (MetaPositionExprEnv, mini_icon_width), FALSE },
+  { "mini_icon_height", G_STRUCT_OFFSET (MetaPositionExprEnv, mini_icon_height), FALSE },
+  { "icon_width", G_STRUCT_OFFSET (MetaPositionExprEnv, icon_width), FALSE },
+  { "icon_height", G_STRUCT_OFFSET (MetaPositionExprEnv, icon_height), FALSE },
+  { "title_width", G_STRUCT_OFFSET (MetaPositionExprEnv, title_width), FALSE },
+  { "title_height", G_STRUCT_OFFSET (MetaPositionExprEnv, title_height), FALSE },
+  { "frame_x_center", G_STRUCT_OFFSET (MetaPositionExprEnv, frame_x_center), FALSE },
+  { "frame_y_center", G_STRUCT_OFFSET (MetaPositionExprEnv, frame_y_center), FALSE }
 };
 
-/**
- * The type of a PosExpr: either integer, double, or an operation.
- * \ingroup parser
- */
 typedef enum
 {
-  POS_EXPR_INT,
-  POS_EXPR_DOUBLE,
-  POS_EXPR_OPERATOR
-} PosExprType;
+  POS_INSTR_INT,
+  POS_INSTR_DOUBLE,
+  POS_INSTR_VARIABLE,
+  POS_INSTR_OPERATOR
+} PosInstrType;
 
 /**
- * Type and value of an expression in a parsed sequence. We don't
- * keep expressions in a tree; if this is of type POS_EXPR_OPERATOR,
- * the arguments of the operator will be in the array positions
- * immediately preceding and following this operator; they cannot
- * themselves be operators.
+ * One step of a compiled expression. Expressions are compiled to
+ * postfix order: operands push a value, operators replace the two
+ * topmost values with their result.
  *
- * \bug operator is char; it should really be of PosOperatorType.
  * \ingroup parser
  */
 typedef struct
 {
-  PosExprType type;
+  PosInstrType type;
+
   union
   {
-    double double_val;
     int int_val;
-    char operator;
+    double double_val;
+    const PosVariable *variable;
+    PosOperatorType op;
   } d;
-} PosExpr;
+} PosInstr;
+
+/**
+ * A compiled expression in our simple vector drawing language.
+ *
+ * Created by meta_draw_spec_new(), destroyed by meta_draw_spec_free().
+ * The expression is tokenised and compiled once, when the theme is
+ * loaded; pos_eval() then only runs the compiled instructions.
+ * \ingroup parser
+ */
+struct _MetaDrawSpec
+{
+  /**
+   * If this spec is constant, this is the value of the constant;
+   * otherwise it is zero.
+   */
+  gdouble value;
+
+  /** The compiled expression. */
+  PosInstr *instrs;
+
+  /** How many instructions are in the instrs list. */
+  int n_instrs;
+
+  /**
+   * If the expression could not be compiled, the problem, which is
+   * reported whenever it is evaluated; otherwise NULL.
+   */
+  GError *error;
+
+  /** Does the expression contain any variables? */
+  gboolean constant : 1;
+};
 
 /**
  * Frees an array of tokens. All the tokens and their associated memory
@@ -477,10 +537,7 @@ replace_constants (MetaThemeMetacity  *metacity,
           else
             {
               /* If we've found a variable that cannot be replaced then the
-                 expression is not a constant expression and we want to
-                 replace it with a GQuark */
-
-              t->d.v.name_quark = g_quark_from_string (t->d.v.name);
+                 expression is not a constant expression */
               is_constant = FALSE;
             }
         }
@@ -490,106 +547,22 @@ replace_constants (MetaThemeMetacity  *metacity,
 }
 
 /**
- * pos_eval_get_variable:
- * @token: The token representing a variable
- * @result: (out): The value of that variable; not set if the token did not
- *     represent a known variable
- * @env: The environment within which @token should be evaluated
- * @err: (out): Set to the problem if there was a problem
- *
- * There is a predefined set of variables which can appear in an expression.
- * Here we take a token representing a variable, and return the current value
- * of that variable in a particular environment.
- * (The value is always an integer.)
+ * Looks up one of the predefined set of variables which can appear in
+ * an expression.
  *
- * Returns: %TRUE if we found the variable asked for, %FALSE if we didn't
+ * \param name  The name of the variable
+ * \return  The variable, or NULL if there is no variable of that name
  */
-static gboolean
-pos_eval_get_variable (const PosToken             *token,
-                       gdouble                    *result,
-                       const MetaPositionExprEnv  *env,
-                       GError                    **err)
+static const PosVariable *
+lookup_variable (const char *name)
 {
-  GQuark quark;
-
-  quark = token->d.v.name_quark;
-
-  if (quark == g_quark_from_static_string ("width"))
-    {
-      *result = env->rect.width;
-    }
-  else if (quark == g_quark_from_static_string ("height"))
-    {
-      *result = env->rect.height;
-    }
-  else if (env->object_width >= 0 &&
-           quark == g_quark_from_static_string ("object_width"))
-    {
-      *result = env->object_width;
-    }
-  else if (env->object_height >= 0 &&
-           quark == g_quark_from_static_string ("object_height"))
-    {
-      *result = env->object_height;
-    }
-  else if (quark == g_quark_from_static_string ("left_width"))
-    {
-      *result = env->left_width;
-    }
-  else if (quark == g_quark_from_static_string ("right_width"))
-    {
-      *result = env->right_width;
-    }
-  else if (quark == g_quark_from_static_string ("top_height"))
-    {
-      *result = env->top_height;
-    }
-  else if (quark == g_quark_from_static_string ("bottom_height"))
-    {
-      *result = env->bottom_height;
-    }
-  else if (quark == g_quark_from_static_string ("mini_icon_width"))
-    {
-      *result = env->mini_icon_width;
-    }
-  else if (quark == g_quark_from_static_string ("mini_icon_height"))
-    {
-      *result = env->mini_icon_height;
-    }
-  else if (quark == g_quark_from_static_string ("icon_width"))
-    {
-      *result = env->icon_width;
-    }
-  else if (quark == g_quark_from_static_string ("icon_height"))
-    {
-      *result = env->icon_height;
-    }
-  else if (quark == g_quark_from_static_string ("title_width"))
-    {
-      *result = env->title_width;
-    }
-  else if (quark == g_quark_from_static_string ("title_height"))
-    {
-      *result = env->title_height;
-    }
-  else if (quark == g_quark_from_static_string ("frame_x_center"))
-    {
-      *result = env->frame_x_center;
-    }
-  else if (quark == g_quark_from_static_string ("frame_y_center"))
-    {
-      *result = env->frame_y_center;
-    }
-  else
-    {
-      g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_UNKNOWN_VARIABLE,
-                   _("Coordinate expression had unknown variable or constant '%s'"),
-                   token->d.v.name);
+  guint i;
 
-      return FALSE;
-    }
+  for (i = 0; i < G_N_ELEMENTS (pos_variables); i++)
+    if (strcmp (name, pos_variables[i].name) == 0)
+      return &pos_variables[i];
 
-  return TRUE;
+  return NULL;
 }
 
 static gboolean
@@ -746,320 +719,345 @@ op_name (PosOperatorType type)
   return "<unknown>";
 }
 
+/* Lazy-ass hardcoded limit on number of terms in expression */
+#define MAX_EXPRS 32
+
+static int
+op_precedence (PosOperatorType op)
+{
+  switch (op)
+    {
+    case POS_OP_DIVIDE:
+    case POS_OP_MOD:
+    case POS_OP_MULTIPLY:
+      return 2;
+    case POS_OP_ADD:
+    case POS_OP_SUBTRACT:
+      return 1;
+      /* I have no rationale at all for making these low-precedence */
+    case POS_OP_MAX:
+    case POS_OP_MIN:
+      return 0;
+    case POS_OP_NONE:
+    default:
+      break;
+    }
+
+  g_assert_not_reached ();
+  return 0;
+}
+
+/**
+ * State of the compiler, shared by all levels of parentheses.
+ * \ingroup parser
+ */
+typedef struct
+{
+  GArray *instrs;
+
+  /* How many values the compiled instructions leave on the stack,
+   * and the most they ever leave there
+   */
+  int depth;
+  int max_depth;
+} PosCompiler;
+
 static gboolean
-do_operations (PosExpr *exprs,
-               int     *n_exprs,
-               int      precedence,
-               GError **err)
+emit_operand (PosCompiler  *compiler,
+              PosInstr     *instr,
+              GError      **err)
 {
-  int i;
+  if (compiler->depth == MAX_EXPRS)
+    {
+      g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_FAILED,
+                   _("Coordinate expression parser overflowed its buffer."));
+      return FALSE;
+    }
+
+  g_array_append_val (compiler->instrs, *instr);
 
-  i = 1;
-  while (i < *n_exprs)
+  compiler->depth += 1;
+  compiler->max_depth = MAX (compiler->max_depth, compiler->depth);
+
+  return TRUE;
+}
+
+static gboolean
+instr_to_expr (const PosInstr *instr,
+               PosExpr        *expr)
+{
+  switch (instr->type)
     {
-      gboolean compress;
-
-      /* exprs[i-1] first operand
-       * exprs[i]   operator
-       * exprs[i+1] second operand
-       *
-       * we replace first operand with result of mul/div/mod,
-       * or skip over operator and second operand if we have
-       * an add/subtract
-       */
-
-      if (exprs[i-1].type == POS_EXPR_OPERATOR)
-        {
-          g_set_error (err, META_THEME_ERROR,
-                       META_THEME_ERROR_FAILED,
-                       _("Coordinate expression has an operator \"%s\" where an operand was expected"),
-                       op_name (exprs[i-1].d.operator));
-          return FALSE;
-        }
+    case POS_INSTR_INT:
+      expr->type = POS_EXPR_INT;
+      expr->d.int_val = instr->d.int_val;
+      return TRUE;
+    case POS_INSTR_DOUBLE:
+      expr->type = POS_EXPR_DOUBLE;
+      expr->d.double_val = instr->d.double_val;
+      return TRUE;
+    case POS_INSTR_VARIABLE:
+    case POS_INSTR_OPERATOR:
+    default:
+      break;
+    }
 
-      if (exprs[i].type != POS_EXPR_OPERATOR)
-        {
-          g_set_error (err, META_THEME_ERROR,
-                       META_THEME_ERROR_FAILED,
-                       _("Coordinate expression had an operand where an operator was expected"));
-          return FALSE;
-        }
+  return FALSE;
+}
 
-      if (i == (*n_exprs - 1))
-        {
-          g_set_error (err, META_THEME_ERROR,
-                       META_THEME_ERROR_FAILED,
-                       _("Coordinate expression ended with an operator instead of an operand"));
-          return FALSE;
-        }
+static void
+emit_operator (PosCompiler     *compiler,
+               PosOperatorType  op)
+{
+  GArray *instrs;
+  PosInstr instr;
 
-      g_assert ((i+1) < *n_exprs);
+  instrs = compiler->instrs;
+  compiler->depth -= 1;
 
-      if (exprs[i+1].type == POS_EXPR_OPERATOR)
-        {
-          g_set_error (err, META_THEME_ERROR,
-                       META_THEME_ERROR_FAILED,
-                       _("Coordinate expression has operator \"%c\" following operator \"%c\" with no operand in between"),
-                       exprs[i+1].d.operator,
-                       exprs[i].d.operator);
-          return FALSE;
-        }
+  /* Fold operations on two constants, unless that fails; then the
+   * failure is reported when the expression is evaluated.
+   */
+  if (instrs->len >= 2)
+    {
+      PosInstr *last;
+      PosExpr a;
+      PosExpr b;
 
-      compress = FALSE;
+      last = &g_array_index (instrs, PosInstr, instrs->len - 2);
 
-      switch (precedence)
+      if (instr_to_expr (&last[0], &a) &&
+          instr_to_expr (&last[1], &b) &&
+          do_operation (&a, &b, op, NULL))
         {
-        case 2:
-          switch (exprs[i].d.operator)
+          if (a.type == POS_EXPR_INT)
             {
-            case POS_OP_DIVIDE:
-            case POS_OP_MOD:
-            case POS_OP_MULTIPLY:
-              compress = TRUE;
-              if (!do_operation (&exprs[i-1], &exprs[i+1],
-                                 exprs[i].d.operator,
-                                 err))
-                return FALSE;
-              break;
-            default:
-              break;
-            }
-          break;
-        case 1:
-          switch (exprs[i].d.operator)
-            {
-            case POS_OP_ADD:
-            case POS_OP_SUBTRACT:
-              compress = TRUE;
-              if (!do_operation (&exprs[i-1], &exprs[i+1],
-                                 exprs[i].d.operator,
-                                 err))
-                return FALSE;
-              break;
-            default:
-              break;
-            }
-          break;
-          /* I have no rationale at all for making these low-precedence */
-        case 0:
-          switch (exprs[i].d.operator)
-            {
-            case POS_OP_MAX:
-            case POS_OP_MIN:
-              compress = TRUE;
-              if (!do_operation (&exprs[i-1], &exprs[i+1],
-                                 exprs[i].d.operator,
-                                 err))
-                return FALSE;
-              break;
-            default:
-              break;
+              last[0].type = POS_INSTR_INT;
+              last[0].d.int_val = a.d.int_val;
             }
-          break;
-        default:
-          break;
-        }
-
-      if (compress)
-        {
-          /* exprs[i-1] first operand (now result)
-           * exprs[i]   operator
-           * exprs[i+1] second operand
-           * exprs[i+2] new operator
-           *
-           * we move new operator just after first operand
-           */
-          if ((i+2) < *n_exprs)
+          else
             {
-              g_memmove (&exprs[i], &exprs[i+2],
-                         sizeof (PosExpr) * (*n_exprs - i - 2));
+              last[0].type = POS_INSTR_DOUBLE;
+              last[0].d.double_val = a.d.double_val;
             }
 
-          *n_exprs -= 2;
-        }
-      else
-        {
-          /* Skip operator and next operand */
-          i += 2;
+          g_array_set_size (instrs, instrs->len - 1);
+          return;
         }
     }
 
-  return TRUE;
+  instr.type = POS_INSTR_OPERATOR;
+  instr.d.op = op;
+  g_array_append_val (instrs, instr);
 }
 
 /**
- * Evaluates a sequence of tokens within a particular environment context,
- * and returns the current value. May recur if parantheses are found.
+ * Compiles a sequence of tokens to postfix order. Recurs for the
+ * contents of parentheses.
  *
- * \param tokens  A list of tokens to evaluate.
+ * \param compiler  The compiler state, to which instructions are added.
+ * \param tokens  A list of tokens to compile.
  * \param n_tokens  How many tokens are in the list.
- * \param env  The environment context in which to evaluate the expression.
- * \param[out] result  The current value of the expression
+ * \param[out] err  Set to the problem if there was a problem
  *
- * \bug Yes, we really do reparse the expression every time it's evaluated.
- *      We should keep the parse tree around all the time and just
- *      run the new values through it.
  * \ingroup parser
  */
 static gboolean
-pos_eval_helper (PosToken                   *tokens,
-                 int                         n_tokens,
-                 const MetaPositionExprEnv  *env,
-                 PosExpr                    *result,
-                 GError                    **err)
+pos_compile_helper (PosCompiler  *compiler,
+                    PosToken     *tokens,
+                    int           n_tokens,
+                    GError      **err)
 {
-  /* Lazy-ass hardcoded limit on number of terms in expression */
-#define MAX_EXPRS 32
-  int paren_level;
-  int first_paren;
+  PosOperatorType ops[MAX_EXPRS];
+  int n_ops;
+  int n_operands;
+  gboolean expect_operand;
   int i;
-  PosExpr exprs[MAX_EXPRS];
-  int n_exprs;
-  int precedence;
 
-  /* Our first goal is to get a list of PosExpr, essentially
-   * substituting variables and handling parentheses.
-   */
+  n_ops = 0;
+  n_operands = 0;
+  expect_operand = TRUE;
 
-  first_paren = 0;
-  paren_level = 0;
-  n_exprs = 0;
   for (i = 0; i < n_tokens; i++)
     {
       PosToken *t = &tokens[i];
+      PosInstr instr;
 
-      if (n_exprs >= MAX_EXPRS)
+      if (t->type == POS_TOKEN_OPERATOR)
         {
-          g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_FAILED,
-                       _("Coordinate expression parser overflowed its buffer."));
-          return FALSE;
-        }
-
-      if (paren_level == 0)
-        {
-          gdouble double_val;
-
-          switch (t->type)
+          if (expect_operand)
             {
-            case POS_TOKEN_INT:
-              exprs[n_exprs].type = POS_EXPR_INT;
-              exprs[n_exprs].d.int_val = t->d.i.val;
-              ++n_exprs;
-              break;
-
-            case POS_TOKEN_DOUBLE:
-              exprs[n_exprs].type = POS_EXPR_DOUBLE;
-              exprs[n_exprs].d.double_val = t->d.d.val;
-              ++n_exprs;
-              break;
-
-            case POS_TOKEN_OPEN_PAREN:
-              ++paren_level;
-              if (paren_level == 1)
-                first_paren = i;
-              break;
-
-            case POS_TOKEN_CLOSE_PAREN:
-              g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_BAD_PARENS,
-                           _("Coordinate expression had a close parenthesis with no open parenthesis"));
+              if (n_operands == 0)
+                g_set_error (err, META_THEME_ERROR,
+                             META_THEME_ERROR_FAILED,
+                             _("Coordinate expression has an operator \"%s\" where an operand was expected"),
+                             op_name (t->d.o.op));
+              else
+                g_set_error (err, META_THEME_ERROR,
+                             META_THEME_ERROR_FAILED,
+                             _("Coordinate expression has operator \"%c\" following operator \"%c\" with no operand in between"),
+                             t->d.o.op, ops[n_ops - 1]);
               return FALSE;
+            }
 
-            case POS_TOKEN_VARIABLE:
-              exprs[n_exprs].type = env->scale > 1 ? POS_EXPR_DOUBLE : POS_EXPR_INT;
-
-              /* FIXME we should just dump all this crap
-               * in a hash, maybe keep width/height out
-               * for optimization purposes
-               */
-              if (!pos_eval_get_variable (t, &double_val, env, err))
-                return FALSE;
+          /* All operators are left associative */
+          while (n_ops > 0 &&
+                 op_precedence (ops[n_ops - 1]) >= op_precedence (t->d.o.op))
+            emit_operator (compiler, ops[--n_ops]);
 
-              if (env->scale > 1)
-                exprs[n_exprs].d.double_val = double_val;
-              else
-                exprs[n_exprs].d.int_val = double_val;
+          if (n_ops == MAX_EXPRS)
+            {
+              g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_FAILED,
+                           _("Coordinate expression parser overflowed its buffer."));
+              return FALSE;
+            }
 
-              ++n_exprs;
-              break;
+          ops[n_ops++] = t->d.o.op;
+          expect_operand = TRUE;
+          continue;
+        }
 
-            case POS_TOKEN_OPERATOR:
-              exprs[n_exprs].type = POS_EXPR_OPERATOR;
-              exprs[n_exprs].d.operator = t->d.o.op;
-              ++n_exprs;
-              break;
+      if (t->type == POS_TOKEN_CLOSE_PAREN)
+        {
+          g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_BAD_PARENS,
+                       _("Coordinate expression had a close parenthesis with no open parenthesis"));
+          return FALSE;
+        }
 
-            default:
-              break;
-            }
+      if (!expect_operand)
+        {
+          g_set_error (err, META_THEME_ERROR,
+                       META_THEME_ERROR_FAILED,
+                       _("Coordinate expression had an operand where an operator was expected"));
+          return FALSE;
         }
-      else
+
+      switch (t->type)
         {
-          g_assert (paren_level > 0);
+        case POS_TOKEN_INT:
+          instr.type = POS_INSTR_INT;
+          instr.d.int_val = t->d.i.val;
+          if (!emit_operand (compiler, &instr, err))
+            return FALSE;
+          break;
+
+        case POS_TOKEN_DOUBLE:
+          instr.type = POS_INSTR_DOUBLE;
+          instr.d.double_val = t->d.d.val;
+          if (!emit_operand (compiler, &instr, err))
+            return FALSE;
+          break;
 
-          switch (t->type)
+        case POS_TOKEN_VARIABLE:
+          instr.type = POS_INSTR_VARIABLE;
+          instr.d.variable = lookup_variable (t->d.v.name);
+          if (instr.d.variable == NULL)
             {
-            case POS_TOKEN_INT:
-            case POS_TOKEN_DOUBLE:
-            case POS_TOKEN_VARIABLE:
-            case POS_TOKEN_OPERATOR:
-              break;
-
-            case POS_TOKEN_OPEN_PAREN:
-              ++paren_level;
-              break;
-
-            case POS_TOKEN_CLOSE_PAREN:
-              if (paren_level == 1)
-                {
-                  /* We closed a toplevel paren group, so recurse */
-                  if (!pos_eval_helper (&tokens[first_paren+1],
-                                        i - first_paren - 1,
-                                        env,
-                                        &exprs[n_exprs],
-                                        err))
-                    return FALSE;
-
-                  ++n_exprs;
-                }
-
-              --paren_level;
-              break;
-
-            default:
-              break;
+              g_set_error (err, META_THEME_ERROR,
+                           META_THEME_ERROR_UNKNOWN_VARIABLE,
+                           _("Coordinate expression had unknown variable or constant '%s'"),
+                           t->d.v.name);
+              return FALSE;
             }
+          if (!emit_operand (compiler, &instr, err))
+            return FALSE;
+          break;
+
+        case POS_TOKEN_OPEN_PAREN:
+          {
+            int paren_level;
+            int first_paren;
+
+            first_paren = i;
+            paren_level = 1;
+            while (paren_level > 0 && ++i < n_tokens)
+              {
+                if (tokens[i].type == POS_TOKEN_OPEN_PAREN)
+                  ++paren_level;
+                else if (tokens[i].type == POS_TOKEN_CLOSE_PAREN)
+                  --paren_level;
+              }
+
+            if (paren_level > 0)
+              {
+                g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_BAD_PARENS,
+                             _("Coordinate expression had an open parenthesis with no close parenthesis"));
+                return FALSE;
+              }
+
+            /* We closed a toplevel paren group, so recurse */
+            if (!pos_compile_helper (compiler, &tokens[first_paren + 1],
+                                     i - first_paren - 1, err))
+              return FALSE;
+          }
+          break;
+
+        case POS_TOKEN_OPERATOR:
+        case POS_TOKEN_CLOSE_PAREN:
+        default:
+          g_assert_not_reached ();
+          break;
         }
+
+      n_operands += 1;
+      expect_operand = FALSE;
     }
 
-  if (paren_level > 0)
+  if (n_operands == 0)
     {
-      g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_BAD_PARENS,
-                   _("Coordinate expression had an open parenthesis with no close parenthesis"));
+      g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_FAILED,
+                   _("Coordinate expression doesn't seem to have any operators or operands"));
       return FALSE;
     }
 
-  /* Now we have no parens and no vars; so we just do all the multiplies
-   * and divides, then all the add and subtract.
-   */
-  if (n_exprs == 0)
+  if (expect_operand)
     {
-      g_set_error (err, META_THEME_ERROR, META_THEME_ERROR_FAILED,
-                   _("Coordinate expression doesn't seem to have any operators or operands"));
+      g_set_error (err, META_THEME_ERROR,
+                   META_THEME_ERROR_FAILED,
+                   _("Coordinate expression ended with an operator instead of an operand"));
       return FALSE;
     }
 
-  /* precedence 1 ops */
-  precedence = 2;
-  while (precedence >= 0)
+  while (n_ops > 0)
+    emit_operator (compiler, ops[--n_ops]);
+
+  return TRUE;
+}
+
+/**
+ * Compiles an expression, so that evaluating it needs neither parsing
+ * nor looking up variables by name.
+ *
+ * \param spec  The expression, whose instructions are set.
+ * \param tokens  The tokens of the expression.
+ * \param n_tokens  How many tokens are in the list.
+ * \param[out] err  Set to the problem if there was a problem
+ *
+ * \ingroup parser
+ */
+static gboolean
+pos_compile (MetaDrawSpec  *spec,
+             PosToken      *tokens,
+             int            n_tokens,
+             GError       **err)
+{
+  PosCompiler compiler;
+
+  compiler.instrs = g_array_new (FALSE, FALSE, sizeof (PosInstr));
+  compiler.depth = 0;
+  compiler.max_depth = 0;
+
+  if (!pos_compile_helper (&compiler, tokens, n_tokens, err))
     {
-      if (!do_operations (exprs, &n_exprs, precedence, err))
-        return FALSE;
-      --precedence;
+      g_array_free (compiler.instrs, TRUE);
+      return FALSE;
     }
 
-  g_assert (n_exprs == 1);
+  g_assert (compiler.depth == 1);
+  g_assert (compiler.max_depth <= MAX_EXPRS);
 
-  *result = *exprs;
+  spec->n_instrs = compiler.instrs->len;
+  spec->instrs = (PosInstr *) g_array_free (compiler.instrs, FALSE);
 
   return TRUE;
 }
@@ -1092,31 +1090,88 @@ pos_eval (MetaDrawSpec              *spec,
           gdouble                   *val_p,
           GError                   **err)
 {
-  PosExpr expr;
+  PosExpr stack[MAX_EXPRS];
+  int n_stack;
+  int i;
 
   *val_p = 0;
 
-  if (pos_eval_helper (spec->tokens, spec->n_tokens, env, &expr, err))
+  if (spec->error != NULL)
+    {
+      g_propagate_error (err, g_error_copy (spec->error));
+      return FALSE;
+    }
+
+  n_stack = 0;
+  for (i = 0; i < spec->n_instrs; i++)
     {
-      switch (expr.type)
+      const PosInstr *instr = &spec->instrs[i];
+      const PosVariable *variable;
+      gdouble value;
+
+      switch (instr->type)
         {
-        case POS_EXPR_INT:
-          *val_p = expr.d.int_val;
+        case POS_INSTR_INT:
+          stack[n_stack].type = POS_EXPR_INT;
+          stack[n_stack].d.int_val = instr->d.int_val;
+          ++n_stack;
+          break;
+
+        case POS_INSTR_DOUBLE:
+          stack[n_stack].type = POS_EXPR_DOUBLE;
+          stack[n_stack].d.double_val = instr->d.double_val;
+          ++n_stack;
+          break;
+
+        case POS_INSTR_VARIABLE:
+          variable = instr->d.variable;
+          value = *(const gdouble *) ((const guint8 *) env + variable->offset);
+
+          if (variable->optional && value < 0)
+            {
+              g_set_error (err, META_THEME_ERROR,
+                           META_THEME_ERROR_UNKNOWN_VARIABLE,
+                           _("Coordinate expression had unknown variable or constant '%s'"),
+                           variable->name);
+              return FALSE;
+            }
+
+          if (env->scale > 1)
+            {
+              stack[n_stack].type = POS_EXPR_DOUBLE;
+              stack[n_stack].d.double_val = value;
+            }
+          else
+            {
+              stack[n_stack].type = POS_EXPR_INT;
+              stack[n_stack].d.int_val = value;
+            }
+
+          ++n_stack;
           break;
-        case POS_EXPR_DOUBLE:
-          *val_p = expr.d.double_val;
+
+        case POS_INSTR_OPERATOR:
+          if (!do_operation (&stack[n_stack - 2], &stack[n_stack - 1],
+                             instr->d.op, err))
+            return FALSE;
+
+          --n_stack;
           break;
-        case POS_EXPR_OPERATOR:
+
         default:
           g_assert_not_reached ();
           break;
         }
-      return TRUE;
     }
+
+  g_assert (n_stack == 1);
+
+  if (stack[0].type == POS_EXPR_INT)
+    *val_p = stack[0].d.int_val;
   else
-    {
-      return FALSE;
-    }
+    *val_p = stack[0].d.double_val;
+
+  return TRUE;
 }
 
 /* We always return both X and Y, but only one will be meaningful in
@@ -1191,13 +1246,22 @@ meta_draw_spec_new (MetaThemeMetacity  *metacity,
                     GError            **error)
 {
   MetaDrawSpec *spec;
+  PosToken *tokens;
+  int n_tokens;
 
   spec = g_slice_new0 (MetaDrawSpec);
 
-  pos_tokenize (expr, &spec->tokens, &spec->n_tokens, NULL);
+  if (pos_tokenize (expr, &tokens, &n_tokens, &spec->error))
+    {
+      spec->constant = replace_constants (metacity, tokens, n_tokens, NULL);
 
-  spec->constant = replace_constants (metacity, spec->tokens,
-                                      spec->n_tokens, NULL);
+      pos_compile (spec, tokens, n_tokens, &spec->error);
+      free_tokens (tokens, n_tokens);
+    }
+  else
+    {
+      spec->constant = TRUE;
+    }
 
   if (spec->constant)
     {
@@ -1221,7 +1285,8 @@ meta_draw_spec_free (MetaDrawSpec *spec)
   if (!spec)
     return;
 
-  free_tokens (spec->tokens, spec->n_tokens);
+  g_free (spec->instrs);
+  g_clear_error (&spec->error);
   g_slice_free (MetaDrawSpec, spec);
 }
 
@@ -696,13 +696,14 @@ meta_theme_gtk_draw_frame (MetaThemeImpl           *impl,
       PangoRectangle logical;
       gdouble text_width, x, y;
 
-      pango_layout_set_width (title_layout, -1);
-      pango_layout_get_pixel_extents (title_layout, NULL, &logical);
+      get_title_layout_extents (title_layout, NULL, &logical);
 
       text_width = MIN(fgeom->title_rect.width / scale, logical.width);
 
       if (text_width < logical.width)
         pango_layout_set_width (title_layout, PANGO_SCALE * text_width);
+      else
+        pango_layout_set_width (title_layout, -1);
 
       /* Center within the frame if possible */
       x = titlebar_rect.x + (titlebar_rect.width - text_width) / 2;
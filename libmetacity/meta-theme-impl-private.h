@@ -95,6 +95,11 @@ G_GNUC_INTERNAL
 void               scale_border                   (GtkBorder               *border,
                                                    double                   factor);
 
+G_GNUC_INTERNAL
+void               get_title_layout_extents       (PangoLayout             *layout,
+                                                   PangoRectangle          *ink_rect,
+                                                   PangoRectangle          *logical_rect);
+
 G_GNUC_INTERNAL
 gboolean           is_button_visible              (MetaButton              *button,
                                                    MetaFrameFlags           flags);
@@ -164,6 +164,38 @@ scale_border (GtkBorder *border,
   border->bottom *= factor;
 }
 
+/* Gets the extents of a title layout without ellipsization. They are
+ * measured once and kept with the layout, so that a layout left
+ * ellipsized by the last draw doesn't have to be shaped again just to
+ * be measured.
+ */
+void
+get_title_layout_extents (PangoLayout    *layout,
+                          PangoRectangle *ink_rect,
+                          PangoRectangle *logical_rect)
+{
+  PangoRectangle *extents;
+
+  extents = g_object_get_data (G_OBJECT (layout), "meta-title-extents");
+
+  if (extents == NULL)
+    {
+      extents = g_new (PangoRectangle, 2);
+
+      pango_layout_set_width (layout, -1);
+      pango_layout_get_pixel_extents (layout, &extents[0], &extents[1]);
+
+      g_object_set_data_full (G_OBJECT (layout), "meta-title-extents",
+                              extents, g_free);
+    }
+
+  if (ink_rect != NULL)
+    *ink_rect = extents[0];
+
+  if (logical_rect != NULL)
+    *logical_rect = extents[1];
+}
+
 gboolean
 is_button_visible (MetaButton     *button,
                    MetaFrameFlags  flags)
@@ -5355,8 +5355,7 @@ meta_theme_metacity_draw_frame (MetaThemeImpl           *impl,
   bottom_edge.height = borders->visible.bottom / scale;
 
   if (title_layout)
-    pango_layout_get_pixel_extents (title_layout,
-                                    NULL, &extents);
+    get_title_layout_extents (title_layout, NULL, &extents);
 
   draw_info.scale = scale;
 
@@ -49,14 +49,38 @@ struct _MetaTheme
 
   GHashTable           *font_descs;
   GHashTable           *title_heights;
+
+  /* Shaped title layouts; the same entries, most recently used
+   * first, are in title_layout_lru
+   */
+  GHashTable           *title_layouts;
+  GQueue                title_layout_lru;
+  guint                 title_layout_hits;
+  guint                 title_layout_misses;
 };
 
+/* How many title layouts are kept */
+#define MAX_TITLE_LAYOUTS 32
+
+typedef struct
+{
+  gchar                      *title;
+  const PangoFontDescription *font_desc;
+  gint                        title_width;
+
+  PangoLayout                *layout;
+  GList                       link;
+} TitleLayout;
+
 enum
 {
   PROP_0,
 
   PROP_TYPE,
 
+  PROP_TITLE_LAYOUT_HITS,
+  PROP_TITLE_LAYOUT_MISSES,
+
   LAST_PROP
 };
 
@@ -346,6 +370,102 @@ create_title_layout (MetaTheme      *theme,
   return layout;
 }
 
+static guint
+title_layout_hash (gconstpointer v)
+{
+  const TitleLayout *entry = v;
+
+  return g_str_hash (entry->title ? entry->title : "") ^
+         g_direct_hash (entry->font_desc) ^
+         entry->title_width;
+}
+
+static gboolean
+title_layout_equal (gconstpointer v1,
+                    gconstpointer v2)
+{
+  const TitleLayout *entry1 = v1;
+  const TitleLayout *entry2 = v2;
+
+  return entry1->font_desc == entry2->font_desc &&
+         entry1->title_width == entry2->title_width &&
+         g_strcmp0 (entry1->title, entry2->title) == 0;
+}
+
+static void
+title_layout_free (gpointer data)
+{
+  TitleLayout *entry = data;
+
+  g_object_unref (entry->layout);
+  g_free (entry->title);
+  g_free (entry);
+}
+
+static void
+clear_title_layouts (MetaTheme *theme)
+{
+  g_hash_table_remove_all (theme->title_layouts);
+  g_queue_init (&theme->title_layout_lru);
+}
+
+/* Returns a layout for the title, shaped already if the same title
+ * was drawn recently with the same font into a title area of the same
+ * width. The layout keeps the ellipsization of its last draw, which
+ * the width decides, so drawing it again doesn't shape it again. The
+ * layout belongs to the theme.
+ */
+static PangoLayout *
+get_title_layout (MetaTheme      *theme,
+                  const gchar    *variant,
+                  MetaFrameType   type,
+                  MetaFrameFlags  flags,
+                  const gchar    *title,
+                  gint            title_width)
+{
+  TitleLayout lookup;
+  TitleLayout *entry;
+
+  lookup.title = (gchar *) title;
+  lookup.font_desc = get_title_font_desc (theme, variant, type, flags);
+  lookup.title_width = title_width;
+
+  entry = g_hash_table_lookup (theme->title_layouts, &lookup);
+
+  if (entry != NULL)
+    {
+      theme->title_layout_hits++;
+
+      g_queue_unlink (&theme->title_layout_lru, &entry->link);
+      g_queue_push_head_link (&theme->title_layout_lru, &entry->link);
+
+      return entry->layout;
+    }
+
+  theme->title_layout_misses++;
+
+  entry = g_new0 (TitleLayout, 1);
+  entry->title = g_strdup (title);
+  entry->font_desc = lookup.font_desc;
+  entry->title_width = title_width;
+  entry->layout = create_title_layout (theme, variant, type, flags, title);
+  entry->link.data = entry;
+
+  g_hash_table_add (theme->title_layouts, entry);
+  g_queue_push_head_link (&theme->title_layout_lru, &entry->link);
+
+  if (theme->title_layout_lru.length > MAX_TITLE_LAYOUTS)
+    {
+      TitleLayout *oldest;
+
+      oldest = theme->title_layout_lru.tail->data;
+      g_queue_unlink (&theme->title_layout_lru, &oldest->link);
+      g_hash_table_remove (theme->title_layouts, oldest);
+    }
+
+  return entry->layout;
+}
+
 static void
 notify_gtk_theme_name_cb (GtkSettings *settings,
                           GParamSpec  *pspec,
@@ -401,6 +521,7 @@ meta_theme_dispose (GObject *object)
 
   g_clear_pointer (&theme->variants, g_hash_table_destroy);
 
+  g_clear_pointer (&theme->title_layouts, g_hash_table_destroy);
   g_clear_object (&theme->context);
 
   g_clear_pointer (&theme->font_descs, g_hash_table_destroy);
@@ -433,6 +554,32 @@ meta_theme_finalize (GObject *object)
   G_OBJECT_CLASS (meta_theme_parent_class)->finalize (object);
 }
 
+static void
+meta_theme_get_property (GObject    *object,
+                         guint       property_id,
+                         GValue     *value,
+                         GParamSpec *pspec)
+{
+  MetaTheme *theme;
+
+  theme = META_THEME (object);
+
+  switch (property_id)
+    {
+      case PROP_TITLE_LAYOUT_HITS:
+        g_value_set_uint (value, theme->title_layout_hits);
+        break;
+
+      case PROP_TITLE_LAYOUT_MISSES:
+        g_value_set_uint (value, theme->title_layout_misses);
+        break;
+
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
 static void
 meta_theme_set_property (GObject      *object,
                          guint         property_id,
@@ -464,6 +611,18 @@ meta_theme_install_properties (GObjectClass *object_class)
                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
                         G_PARAM_STATIC_STRINGS);
 
+  properties[PROP_TITLE_LAYOUT_HITS] =
+    g_param_spec_uint ("title-layout-hits", "title-layout-hits",
+                       "title-layout-hits",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_TITLE_LAYOUT_MISSES] =
+    g_param_spec_uint ("title-layout-misses", "title-layout-misses",
+                       "title-layout-misses",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, LAST_PROP, properties);
 }
 
@@ -477,6 +636,7 @@ meta_theme_class_init (MetaThemeClass *theme_class)
   object_class->constructed = meta_theme_constructed;
   object_class->dispose = meta_theme_dispose;
   object_class->finalize = meta_theme_finalize;
+  object_class->get_property = meta_theme_get_property;
   object_class->set_property = meta_theme_set_property;
 
   meta_theme_install_properties (object_class);
@@ -494,6 +654,11 @@ meta_theme_init (MetaTheme *theme)
                                              (GDestroyNotify) pango_font_description_free);
 
   theme->title_heights = g_hash_table_new (NULL, NULL);
+
+  theme->title_layouts = g_hash_table_new_full (title_layout_hash,
+                                                title_layout_equal,
+                                                NULL, title_layout_free);
+  g_queue_init (&theme->title_layout_lru);
 }
 
 /**
@@ -554,6 +719,7 @@ void
 meta_theme_invalidate (MetaTheme *theme)
 {
   g_hash_table_remove_all (theme->variants);
+  clear_title_layouts (theme);
   g_clear_object (&theme->context);
   g_hash_table_remove_all (theme->font_descs);
   g_hash_table_remove_all (theme->title_heights);
@@ -703,6 +869,7 @@ meta_theme_set_titlebar_font (MetaTheme                  *theme,
   pango_font_description_free (theme->titlebar_font);
   theme->titlebar_font = pango_font_description_copy (titlebar_font);
 
+  clear_title_layouts (theme);
   g_hash_table_remove_all (theme->font_descs);
   g_hash_table_remove_all (theme->title_heights);
 }
@@ -801,12 +968,14 @@ meta_theme_draw_frame (MetaTheme           *theme,
   impl_class = META_THEME_IMPL_GET_CLASS (theme->impl);
   style_info = get_style_info (theme, variant);
   title_height = get_title_height (theme, variant, type, flags);
-  title_layout = create_title_layout (theme, variant, type, flags, title);
 
   impl_class->calc_geometry (theme->impl, style->layout, style_info,
                              title_height, flags, client_width, client_height,
                              theme->button_layout, type, &fgeom);
 
+  title_layout = get_title_layout (theme, variant, type, flags, title,
+                                   fgeom.title_rect.width);
+
   for (i = 0; i < 2; i++)
     {
       MetaButton *buttons;
@@ -856,6 +1025,4 @@ meta_theme_draw_frame (MetaTheme           *theme,
   impl_class->draw_frame (theme->impl, style, style_info, cr, &fgeom,
                           title_layout, flags, theme->button_layout,
                           mini_icon, icon);
-
-  g_object_unref (title_layout);
 }
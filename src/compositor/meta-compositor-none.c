@@ -128,6 +128,12 @@ meta_compositor_none_unmaximize_window (MetaCompositor *compositor,
 {
 }
 
+static gchar *
+meta_compositor_none_get_stats_report (MetaCompositor *compositor)
+{
+  return g_strdup ("Compositing disabled\n");
+}
+
 static void
 meta_compositor_none_class_init (MetaCompositorNoneClass *none_class)
 {
@@ -150,6 +156,7 @@ meta_compositor_none_class_init (MetaCompositorNoneClass *none_class)
   compositor_class->free_window = meta_compositor_none_free_window;
   compositor_class->maximize_window = meta_compositor_none_maximize_window;
   compositor_class->unmaximize_window = meta_compositor_none_unmaximize_window;
+  compositor_class->get_stats_report = meta_compositor_none_get_stats_report;
 }
 
 static void
@@ -81,6 +81,8 @@ struct _MetaCompositorClass
 
   void              (* unmaximize_window)  (MetaCompositor     *compositor,
                                             MetaWindow         *window);
+
+  gchar *           (* get_stats_report)   (MetaCompositor     *compositor);
 };
 
 G_END_DECLS
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <gdk/gdk.h>
@@ -50,8 +51,40 @@
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrender.h>
 
+#ifdef HAVE_RANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+
 #define USE_IDLE_REPAINT 1
 
+/* Used when neither METACITY_COMPOSITOR_REFRESH_RATE nor RandR gives us
+ * the refresh rate of the output.
+ */
+#define DEFAULT_REFRESH_RATE 60
+
+/* Damage made of more rectangles than this is presented as one clipped
+ * copy of its bounding box instead of one copy per rectangle.
+ */
+#define MAX_PRESENT_RECTANGLES 16
+
+/* Windows sending fewer damage notifies per second than DAMAGE_RATE_LOW
+ * report bounding boxes, windows sending more than DAMAGE_RATE_HIGH go
+ * back to a single notify per repaint.
+ */
+#define DAMAGE_RATE_LOW 10
+#define DAMAGE_RATE_HIGH 60
+
+/* Upper bound, in bytes, of the masks and shadows kept for unmapped
+ * windows.
+ */
+#define MAX_CACHED_RESOURCES_SIZE (32 * 1024 * 1024)
+
+/* Window opacities are quantized to this many shared alpha pictures */
+#define N_ALPHA_LEVELS 256
+
+/* Number of recent frames kept for the statistics written on SIGUSR1 */
+#define FRAME_STATS_SIZE 1024
+
 typedef enum _MetaCompWindowType
 {
   META_COMP_WINDOW_NORMAL,
@@ -71,6 +104,18 @@ typedef enum _MetaShadowType
   LAST_SHADOW_TYPE
 } MetaShadowType;
 
+typedef struct _MetaFrameStats
+{
+  /* CPU time of the compositor thread spent painting */
+  gint64 cpu_time;
+  /* Wall clock time, including time spent waiting on the server */
+  gint64 wall_time;
+  gulong requests;
+  guint windows;
+  guint shadows;
+  guint64 damaged_area;
+} MetaFrameStats;
+
 struct _MetaCompositorXRender
 {
   MetaCompositor parent;
@@ -78,6 +123,26 @@ struct _MetaCompositorXRender
 #ifdef USE_IDLE_REPAINT
   guint repaint_id;
 #endif
+
+  /* Frame pacing, all times are in microseconds */
+  gint64 frame_interval;
+  gint64 last_frame_time;
+
+  /* Damage events folded into the frame that is currently pending */
+  guint frame_damage_events;
+
+  guint64 frames_drawn;
+  guint64 damage_events;
+
+  /* Bytes copied from the back buffer to the screen */
+  guint64 frame_bytes;
+  guint64 presented_bytes;
+
+  /* Ring buffer with the statistics of the most recent frames */
+  MetaFrameStats frame_stats[FRAME_STATS_SIZE];
+  guint n_frame_stats;
+  guint next_frame_stats;
+
   guint show_redraw : 1;
   guint debug : 1;
 };
@@ -95,6 +160,20 @@ typedef struct _shadow
   guchar *shadow_top;
 } shadow;
 
+typedef struct _MetaShadowCacheEntry
+{
+  MetaShadowType shadow_type;
+  double opacity;
+  int width;
+  int height;
+
+  Pixmap pixmap;
+  int pixmap_width;
+  int pixmap_height;
+
+  guint ref_count;
+} MetaShadowCacheEntry;
+
 typedef struct _MetaCompScreen
 {
   MetaScreen *screen;
@@ -108,15 +187,38 @@ typedef struct _MetaCompScreen
   gboolean have_shadows;
   shadow *shadows[LAST_SHADOW_TYPE];
 
+  /* Uploaded shadow pixmaps shared between windows of the same size */
+  GHashTable *shadow_cache;
+
   Picture root_picture;
   Picture root_buffer;
+  /* Number of frames presented from root_buffer, 0 if its contents are
+   * undefined.
+   */
+  guint root_buffer_age;
   Picture black_picture;
+  /* Solid alpha pictures shared by all translucent windows */
+  Picture alpha_pictures[N_ALPHA_LEVELS];
   Picture root_tile;
   XserverRegion all_damage;
 
   gboolean clip_changed;
 
   GSList *dock_windows;
+
+  /* Fullscreen window that is currently drawn by the X server directly,
+   * and the output it covers. The overlay window has a hole there.
+   */
+  struct _MetaCompWindow *unredirected_window;
+  cairo_rectangle_int_t unredirected_rect;
+
+  /* Unmapped windows with cached resources, most recently unmapped first */
+  GQueue cached_windows;
+  gsize cached_size;
+
+  /* Windows and shadows painted in the current frame */
+  guint n_painted_windows;
+  guint n_painted_shadows;
 } MetaCompScreen;
 
 typedef struct _MetaCompWindow
@@ -136,9 +238,30 @@ typedef struct _MetaCompWindow
 
   XRectangle shape_bounds;
 
+  /* Bounding shape of a shaped window, relative to the window origin.
+   * Fetched once and dropped on ShapeNotify, so the window region can
+   * be computed without a round trip.
+   */
+  XRectangle *shape_rects;
+  int n_shape_rects;
+  gboolean shape_rects_valid;
+
   MetaCompWindowType type;
 
   Damage damage;
+  int damage_level;
+
+  /* Set when damage was notified, the damage is fetched once per frame */
+  gboolean damage_pending;
+  /* Union of the areas notified with XDamageReportBoundingBox */
+  cairo_rectangle_int_t damage_bounds;
+
+  /* Damage notify rate, measured over intervals of about a second */
+  gint64 damage_rate_start;
+  guint damage_notifies;
+  guint damage_rate;
+  guint64 total_damage_notifies;
+
   Picture picture;
   Picture mask;
   Picture alpha_pict;
@@ -146,13 +269,16 @@ typedef struct _MetaCompWindow
   gboolean needs_shadow;
   MetaShadowType shadow_type;
 
-  XserverRegion window_region;
-  XserverRegion visible_region;
-  XserverRegion client_region;
+  cairo_region_t *window_region;
+  cairo_region_t *visible_region;
+  cairo_region_t *client_region;
 
   XserverRegion extents;
+  /* Bounds of extents, kept on the client side for occlusion culling */
+  cairo_rectangle_int_t extents_rect;
 
   Picture shadow;
+  MetaShadowCacheEntry *shadow_entry;
   int shadow_dx;
   int shadow_dy;
   int shadow_width;
@@ -160,7 +286,7 @@ typedef struct _MetaCompWindow
 
   guint opacity;
 
-  XserverRegion border_clip;
+  cairo_region_t *border_clip;
 
   /* When the window is shaded we will store few data of the original unshaded
    * window so we can still see what the window looked like when it is needed
@@ -175,8 +301,28 @@ typedef struct _MetaCompWindow
     int width;
     int height;
 
-    XserverRegion client_region;
+    cairo_region_t *client_region;
   } shaded;
+
+  /* Mask and shadow kept while the window is unmapped, so they can be
+   * reused if it is mapped again with the same size and appearance.
+   */
+  struct {
+    GList *link;
+
+    Picture mask;
+    Picture shadow;
+    MetaShadowCacheEntry *shadow_entry;
+    int shadow_width;
+    int shadow_height;
+
+    int width;
+    int height;
+    MetaShadowType shadow_type;
+    guint opacity;
+
+    gsize size;
+  } cached;
 } MetaCompWindow;
 
 #define OPAQUE 0xffffffff
@@ -557,18 +703,17 @@ double shadow_offsets_y[LAST_SHADOW_TYPE] = {SHADOW_SMALL_OFFSET_Y,
                                              SHADOW_MEDIUM_OFFSET_Y,
                                              SHADOW_LARGE_OFFSET_Y};
 
-static XserverRegion
-cairo_region_to_xserver_region (Display        *xdisplay,
-                                cairo_region_t *region)
+static XRectangle *
+cairo_region_to_xrectangles (cairo_region_t *region,
+                             int            *n_rects)
 {
-  int n_rects, i;
   XRectangle *rects;
-  XserverRegion xregion;
+  int i;
 
-  n_rects = cairo_region_num_rectangles (region);
-  rects = g_new (XRectangle, n_rects);
+  *n_rects = cairo_region_num_rectangles (region);
+  rects = g_new (XRectangle, *n_rects);
 
-  for (i = 0; i < n_rects; i++)
+  for (i = 0; i < *n_rects; i++)
     {
       cairo_rectangle_int_t rect;
 
@@ -580,10 +725,23 @@ cairo_region_to_xserver_region (Display        *xdisplay,
       rects[i].height = rect.height;
     }
 
-  xregion = XFixesCreateRegion (xdisplay, rects, n_rects);
-  g_free (rects);
+  return rects;
+}
 
-  return xregion;
+/* Clips a picture to a client side region without creating a server
+ * side region for it.
+ */
+static void
+set_picture_clip_region (Display        *xdisplay,
+                         Picture         picture,
+                         cairo_region_t *region)
+{
+  int n_rects;
+  XRectangle *rects;
+
+  rects = cairo_region_to_xrectangles (region, &n_rects);
+  XRenderSetPictureClipRectangles (xdisplay, picture, 0, 0, rects, n_rects);
+  g_free (rects);
 }
 
 static cairo_region_t *
@@ -638,9 +796,9 @@ shadow_picture_clip (Display          *xdisplay,
   int shadow_dx;
   int shadow_dy;
   cairo_region_t *visible_region;
-  XRectangle rect;
-  XserverRegion region1;
-  XserverRegion region2;
+  cairo_rectangle_int_t rect;
+  cairo_region_t *region1;
+  cairo_region_t *region2;
 
   if (!cw->window)
     return;
@@ -658,84 +816,219 @@ shadow_picture_clip (Display          *xdisplay,
   rect.width = width;
   rect.height = height;
 
-  region1 = XFixesCreateRegion (xdisplay, &rect, 1);
-  region2 = cairo_region_to_xserver_region (xdisplay, visible_region);
+  region1 = cairo_region_create_rectangle (&rect);
+  region2 = cairo_region_copy (visible_region);
 
-  XFixesTranslateRegion (xdisplay, region2,
-                         shadow_dx, shadow_dy);
+  cairo_region_translate (region2, shadow_dx, shadow_dy);
 
-  XFixesSubtractRegion (xdisplay, region1, region1, region2);
-  XFixesSetPictureClipRegion (xdisplay, shadow_picture, 0, 0, region1);
+  cairo_region_subtract (region1, region2);
+  set_picture_clip_region (xdisplay, shadow_picture, region1);
 
-  XFixesDestroyRegion (xdisplay, region1);
-  XFixesDestroyRegion (xdisplay, region2);
+  cairo_region_destroy (region1);
+  cairo_region_destroy (region2);
 }
 
-static Picture
-shadow_picture (MetaDisplay      *display,
-                MetaScreen       *screen,
-                MetaCompWindow   *cw,
-                double            opacity,
-                MetaFrameBorders  borders,
-                int               width,
-                int               height,
-                int              *wp,
-                int              *hp)
+static guint
+shadow_cache_entry_hash (gconstpointer key)
+{
+  const MetaShadowCacheEntry *entry = key;
+  guint hash;
+
+  hash = g_double_hash (&entry->opacity);
+  hash = hash * 31 + entry->shadow_type;
+  hash = hash * 31 + entry->width;
+  hash = hash * 31 + entry->height;
+
+  return hash;
+}
+
+static gboolean
+shadow_cache_entry_equal (gconstpointer a,
+                          gconstpointer b)
+{
+  const MetaShadowCacheEntry *entry_a = a;
+  const MetaShadowCacheEntry *entry_b = b;
+
+  return entry_a->shadow_type == entry_b->shadow_type &&
+         entry_a->opacity == entry_b->opacity &&
+         entry_a->width == entry_b->width &&
+         entry_a->height == entry_b->height;
+}
+
+static MetaShadowCacheEntry *
+shadow_cache_entry_new (MetaDisplay    *display,
+                        MetaScreen     *screen,
+                        MetaShadowType  shadow_type,
+                        double          opacity,
+                        int             width,
+                        int             height)
 {
   Display *xdisplay = meta_display_get_xdisplay (display);
+  Window xroot = meta_screen_get_xroot (screen);
+  MetaShadowCacheEntry *entry;
   XImage *shadow_image;
   Pixmap shadow_pixmap;
-  Picture shadow_picture;
-  Window xroot = meta_screen_get_xroot (screen);
   GC gc;
 
-  shadow_image = make_shadow (display, screen, cw->shadow_type,
+  shadow_image = make_shadow (display, screen, shadow_type,
                               opacity, width, height);
   if (!shadow_image)
-    return None;
+    return NULL;
 
   shadow_pixmap = XCreatePixmap (xdisplay, xroot,
                                  shadow_image->width, shadow_image->height, 8);
   if (!shadow_pixmap)
     {
       XDestroyImage (shadow_image);
-      return None;
-    }
-
-  shadow_picture = XRenderCreatePicture (xdisplay, shadow_pixmap,
-                                         XRenderFindStandardFormat (xdisplay, PictStandardA8),
-                                         0, 0);
-  if (!shadow_picture)
-    {
-      XDestroyImage (shadow_image);
-      XFreePixmap (xdisplay, shadow_pixmap);
-      return None;
+      return NULL;
     }
 
-  shadow_picture_clip (xdisplay, shadow_picture, cw, borders,
-                       shadow_image->width, shadow_image->height);
-
   gc = XCreateGC (xdisplay, shadow_pixmap, 0, 0);
   if (!gc)
     {
       XDestroyImage (shadow_image);
       XFreePixmap (xdisplay, shadow_pixmap);
-      XRenderFreePicture (xdisplay, shadow_picture);
-      return None;
+      return NULL;
     }
 
   XPutImage (xdisplay, shadow_pixmap, gc, shadow_image, 0, 0, 0, 0,
              shadow_image->width, shadow_image->height);
-  *wp = shadow_image->width;
-  *hp = shadow_image->height;
+
+  entry = g_new0 (MetaShadowCacheEntry, 1);
+
+  entry->shadow_type = shadow_type;
+  entry->opacity = opacity;
+  entry->width = width;
+  entry->height = height;
+
+  entry->pixmap = shadow_pixmap;
+  entry->pixmap_width = shadow_image->width;
+  entry->pixmap_height = shadow_image->height;
+
+  entry->ref_count = 1;
 
   XFreeGC (xdisplay, gc);
   XDestroyImage (shadow_image);
-  XFreePixmap (xdisplay, shadow_pixmap);
+
+  return entry;
+}
+
+static MetaShadowCacheEntry *
+shadow_cache_get (MetaDisplay    *display,
+                  MetaScreen     *screen,
+                  MetaShadowType  shadow_type,
+                  double          opacity,
+                  int             width,
+                  int             height)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaShadowCacheEntry key;
+  MetaShadowCacheEntry *entry;
+
+  if (info == NULL)
+    return NULL;
+
+  key.shadow_type = shadow_type;
+  key.opacity = opacity;
+  key.width = width;
+  key.height = height;
+
+  entry = g_hash_table_lookup (info->shadow_cache, &key);
+  if (entry != NULL)
+    {
+      entry->ref_count++;
+      return entry;
+    }
+
+  entry = shadow_cache_entry_new (display, screen, shadow_type,
+                                  opacity, width, height);
+
+  if (entry != NULL)
+    g_hash_table_add (info->shadow_cache, entry);
+
+  return entry;
+}
+
+static void
+shadow_cache_entry_unref (MetaScreen           *screen,
+                          MetaShadowCacheEntry *entry)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+
+  if (--entry->ref_count > 0)
+    return;
+
+  if (info != NULL)
+    g_hash_table_remove (info->shadow_cache, entry);
+
+  XFreePixmap (xdisplay, entry->pixmap);
+  g_free (entry);
+}
+
+static Picture
+shadow_picture (MetaDisplay      *display,
+                MetaScreen       *screen,
+                MetaCompWindow   *cw,
+                double            opacity,
+                MetaFrameBorders  borders,
+                int               width,
+                int               height,
+                int              *wp,
+                int              *hp)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaShadowCacheEntry *entry;
+  Picture shadow_picture;
+
+  entry = shadow_cache_get (display, screen, cw->shadow_type,
+                            opacity, width, height);
+  if (!entry)
+    return None;
+
+  /* The clip depends on the frame shape, so every window gets its own
+   * picture, but the shadow pixels are shared.
+   */
+  shadow_picture = XRenderCreatePicture (xdisplay, entry->pixmap,
+                                         XRenderFindStandardFormat (xdisplay, PictStandardA8),
+                                         0, 0);
+  if (!shadow_picture)
+    {
+      shadow_cache_entry_unref (screen, entry);
+      return None;
+    }
+
+  shadow_picture_clip (xdisplay, shadow_picture, cw, borders,
+                       entry->pixmap_width, entry->pixmap_height);
+
+  *wp = entry->pixmap_width;
+  *hp = entry->pixmap_height;
+
+  cw->shadow_entry = entry;
 
   return shadow_picture;
 }
 
+static void
+free_shadow (MetaCompWindow *cw)
+{
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  if (cw->shadow)
+    {
+      XRenderFreePicture (xdisplay, cw->shadow);
+      cw->shadow = None;
+    }
+
+  if (cw->shadow_entry)
+    {
+      shadow_cache_entry_unref (cw->screen, cw->shadow_entry);
+      cw->shadow_entry = NULL;
+    }
+}
+
 static MetaCompWindow *
 find_window_for_screen (MetaScreen *screen,
                         Window      xwindow)
@@ -1155,58 +1448,112 @@ win_extents (MetaCompWindow *cw)
         r.height = sr.y + sr.height - r.y;
     }
 
+  cw->extents_rect.x = r.x;
+  cw->extents_rect.y = r.y;
+  cw->extents_rect.width = r.width;
+  cw->extents_rect.height = r.height;
+
   return XFixesCreateRegion (xdisplay, &r, 1);
 }
 
-static XserverRegion
-get_window_region (MetaCompWindow *cw)
+static void
+drop_shape_rects (MetaCompWindow *cw)
+{
+  if (cw->shape_rects)
+    {
+      XFree (cw->shape_rects);
+      cw->shape_rects = NULL;
+    }
+
+  cw->n_shape_rects = 0;
+  cw->shape_rects_valid = FALSE;
+}
+
+static void
+fetch_shape_rects (MetaCompWindow *cw)
 {
   MetaDisplay *display;
   Display *xdisplay;
-  XserverRegion region;
-  int x;
-  int y;
+  int ordering;
+  int error_code;
 
   display = meta_screen_get_display (cw->screen);
   xdisplay = meta_display_get_xdisplay (display);
 
+  drop_shape_rects (cw);
+
   meta_error_trap_push (display);
-  region = XFixesCreateRegionFromWindow (xdisplay, cw->id, WindowRegionBounding);
-  meta_error_trap_pop (display);
+  cw->shape_rects = XShapeGetRectangles (xdisplay, cw->id, ShapeBounding,
+                                         &cw->n_shape_rects, &ordering);
+  error_code = meta_error_trap_pop_with_return (display);
 
-  if (region == None)
-    return None;
+  if (error_code != 0 || cw->shape_rects == NULL)
+    {
+      if (cw->shape_rects)
+        XFree (cw->shape_rects);
+
+      cw->shape_rects = NULL;
+      cw->n_shape_rects = 0;
+    }
+
+  cw->shape_rects_valid = TRUE;
+}
+
+static cairo_region_t *
+get_window_region (MetaCompWindow *cw)
+{
+  MetaDisplay *display;
+  cairo_region_t *region;
+  cairo_rectangle_int_t rect;
+  cairo_rectangle_int_t bounds;
+  int x;
+  int y;
+  int i;
+
+  display = meta_screen_get_display (cw->screen);
+
+  bounds.x = cw->attrs.x;
+  bounds.y = cw->attrs.y;
+  bounds.width = cw->attrs.width + cw->attrs.border_width * 2;
+  bounds.height = cw->attrs.height + cw->attrs.border_width * 2;
+
+  if (!cw->shaped || !meta_display_has_shape (display))
+    return cairo_region_create_rectangle (&bounds);
+
+  if (!cw->shape_rects_valid)
+    fetch_shape_rects (cw);
+
+  region = cairo_region_create ();
 
   x = cw->attrs.x + cw->attrs.border_width;
   y = cw->attrs.y + cw->attrs.border_width;
 
-  XFixesTranslateRegion (xdisplay, region, x, y);
+  for (i = 0; i < cw->n_shape_rects; i++)
+    {
+      rect.x = x + cw->shape_rects[i].x;
+      rect.y = y + cw->shape_rects[i].y;
+      rect.width = cw->shape_rects[i].width;
+      rect.height = cw->shape_rects[i].height;
+
+      cairo_region_union_rectangle (region, &rect);
+    }
+
+  /* The window may have grown or shrunk since the shape was fetched */
+  cairo_region_intersect_rectangle (region, &bounds);
 
   return region;
 }
 
-static XserverRegion
+static cairo_region_t *
 get_client_region (MetaCompWindow *cw)
 {
-  MetaDisplay *display;
-  Display *xdisplay;
-  XserverRegion region;
+  cairo_region_t *region;
   MetaFrame *frame;
 
-  display = meta_screen_get_display (cw->screen);
-  xdisplay = meta_display_get_xdisplay (display);
-
-  if (cw->window_region != None)
-    {
-      region = XFixesCreateRegion (xdisplay, NULL, 0);
-      XFixesCopyRegion (xdisplay, region, cw->window_region);
-    }
+  if (cw->window_region != NULL)
+    region = cairo_region_copy (cw->window_region);
   else
-    {
-      region = get_window_region (cw);
-      if (region == None)
-        return None;
-    }
+    region = get_window_region (cw);
 
   frame = cw->window ? meta_window_get_frame (cw->window) : NULL;
 
@@ -1217,8 +1564,7 @@ get_client_region (MetaCompWindow *cw)
       int y;
       int width;
       int height;
-      XRectangle rect;
-      XserverRegion client;
+      cairo_rectangle_int_t rect;
 
       meta_frame_calc_borders (frame, &borders);
 
@@ -1232,56 +1578,41 @@ get_client_region (MetaCompWindow *cw)
       rect.width = width - borders.total.left - borders.total.right;
       rect.height = height - borders.total.top - borders.total.bottom;
 
-      client = XFixesCreateRegion (xdisplay, &rect, 1);
-
-      XFixesIntersectRegion (xdisplay, region, region, client);
-      XFixesDestroyRegion (xdisplay, client);
+      cairo_region_intersect_rectangle (region, &rect);
     }
 
   return region;
 }
 
-static XserverRegion
+static cairo_region_t *
 get_visible_region (MetaCompWindow *cw)
 {
-  MetaDisplay *display;
-  Display *xdisplay;
-  XserverRegion region;
-
-  display = meta_screen_get_display (cw->screen);
-  xdisplay = meta_display_get_xdisplay (display);
+  cairo_region_t *region;
 
-  if (cw->window_region != None)
-    {
-      region = XFixesCreateRegion (xdisplay, NULL, 0);
-      XFixesCopyRegion (xdisplay, region, cw->window_region);
-    }
+  if (cw->window_region != NULL)
+    region = cairo_region_copy (cw->window_region);
   else
-    {
-      region = get_window_region (cw);
-      if (region == None)
-        return None;
-    }
+    region = get_window_region (cw);
 
   if (cw->window)
     {
       cairo_region_t *visible;
-      XserverRegion tmp;
 
       visible = meta_window_get_frame_bounds (cw->window);
-      tmp = visible ? cairo_region_to_xserver_region (xdisplay, visible) : None;
 
-      if (tmp != None)
+      if (visible != NULL)
         {
+          cairo_region_t *tmp;
           int x;
           int y;
 
           x = cw->attrs.x + cw->attrs.border_width;
           y = cw->attrs.y + cw->attrs.border_width;
 
-          XFixesTranslateRegion (xdisplay, tmp, x, y);
-          XFixesIntersectRegion (xdisplay, region, region, tmp);
-          XFixesDestroyRegion (xdisplay, tmp);
+          tmp = cairo_region_copy (visible);
+          cairo_region_translate (tmp, x, y);
+          cairo_region_intersect (region, tmp);
+          cairo_region_destroy (tmp);
         }
     }
 
@@ -1433,9 +1764,9 @@ get_window_mask (MetaCompWindow *cw)
 }
 
 static void
-paint_dock_shadows (MetaScreen   *screen,
-                    Picture       root_buffer,
-                    XserverRegion region)
+paint_dock_shadows (MetaScreen     *screen,
+                    Picture         root_buffer,
+                    cairo_region_t *region)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
@@ -1450,15 +1781,14 @@ paint_dock_shadows (MetaScreen   *screen,
   for (d = info->dock_windows; d; d = d->next)
     {
       MetaCompWindow *cw = d->data;
-      XserverRegion shadow_clip;
+      cairo_region_t *shadow_clip;
 
-      if (cw->shadow)
+      if (cw->shadow && cw->border_clip)
         {
-          shadow_clip = XFixesCreateRegion (xdisplay, NULL, 0);
-          XFixesIntersectRegion (xdisplay, shadow_clip,
-                                 cw->border_clip, region);
+          shadow_clip = cairo_region_copy (cw->border_clip);
+          cairo_region_intersect (shadow_clip, region);
 
-          XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, shadow_clip);
+          set_picture_clip_region (xdisplay, root_buffer, shadow_clip);
 
           XRenderComposite (xdisplay, PictOpOver, info->black_picture,
                             cw->shadow, root_buffer,
@@ -1466,16 +1796,18 @@ paint_dock_shadows (MetaScreen   *screen,
                             cw->attrs.x + cw->shadow_dx,
                             cw->attrs.y + cw->shadow_dy,
                             cw->shadow_width, cw->shadow_height);
-          XFixesDestroyRegion (xdisplay, shadow_clip);
+          cairo_region_destroy (shadow_clip);
+
+          info->n_painted_shadows++;
         }
     }
 }
 
 static void
-paint_windows (MetaScreen   *screen,
-               GList        *windows,
-               Picture       root_buffer,
-               XserverRegion region)
+paint_windows (MetaScreen     *screen,
+               GList          *windows,
+               Picture         root_buffer,
+               cairo_region_t *region)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
@@ -1483,7 +1815,8 @@ paint_windows (MetaScreen   *screen,
   GList *index, *last;
   int screen_width, screen_height;
   MetaCompWindow *cw;
-  XserverRegion paint_region, desktop_region;
+  cairo_region_t *paint_region, *desktop_region;
+  int n_culled;
 
   if (info == NULL)
     {
@@ -1492,22 +1825,13 @@ paint_windows (MetaScreen   *screen,
 
   meta_screen_get_size (screen, &screen_width, &screen_height);
 
-  if (region == None)
-    {
-      XRectangle r;
-      r.x = 0;
-      r.y = 0;
-      r.width = screen_width;
-      r.height = screen_height;
-      paint_region = XFixesCreateRegion (xdisplay, &r, 1);
-    }
-  else
-    {
-      paint_region = XFixesCreateRegion (xdisplay, NULL, 0);
-      XFixesCopyRegion (xdisplay, paint_region, region);
-    }
+  /* The clip computation is done on the client side, only the clip of
+   * each composite operation is sent to the server.
+   */
+  paint_region = cairo_region_copy (region);
 
-  desktop_region = None;
+  desktop_region = NULL;
+  n_culled = 0;
 
   /*
    * Painting from top to bottom, reducing the clipping area at
@@ -1529,6 +1853,10 @@ paint_windows (MetaScreen   *screen,
       if (cw->attrs.map_state != IsViewable)
         continue;
 
+      /* Drawn by the X server, through the hole in the overlay window */
+      if (cw == info->unredirected_window)
+        continue;
+
 #if 0
       if ((cw->attrs.x + cw->attrs.width < 1) ||
           (cw->attrs.y + cw->attrs.height < 1) ||
@@ -1539,32 +1867,26 @@ paint_windows (MetaScreen   *screen,
         }
 #endif
 
-      if (cw->picture == None)
-        cw->picture = get_window_picture (cw);
-
-      if (cw->mask == None)
-        cw->mask = get_window_mask (cw);
-
       /* If the clip region of the screen has been changed
          then we need to recreate the extents of the window */
       if (info->clip_changed)
         {
           if (cw->window_region)
             {
-              XFixesDestroyRegion (xdisplay, cw->window_region);
-              cw->window_region = None;
+              cairo_region_destroy (cw->window_region);
+              cw->window_region = NULL;
             }
 
           if (cw->visible_region)
             {
-              XFixesDestroyRegion (xdisplay, cw->visible_region);
-              cw->visible_region = None;
+              cairo_region_destroy (cw->visible_region);
+              cw->visible_region = NULL;
             }
 
           if (cw->client_region)
             {
-              XFixesDestroyRegion (xdisplay, cw->client_region);
-              cw->client_region = None;
+              cairo_region_destroy (cw->client_region);
+              cw->client_region = NULL;
             }
 
 #if 0
@@ -1576,18 +1898,37 @@ paint_windows (MetaScreen   *screen,
 #endif
         }
 
-      if (cw->window_region == None)
+      if (cw->extents == None)
+        cw->extents = win_extents (cw);
+
+      /* Windows and shadows that are completely covered by the windows
+       * above them are left out of both passes.
+       */
+      if (cairo_region_contains_rectangle (paint_region, &cw->extents_rect) ==
+          CAIRO_REGION_OVERLAP_OUT)
+        {
+          n_culled++;
+          continue;
+        }
+
+      if (cw->picture == None)
+        cw->picture = get_window_picture (cw);
+
+      if (cw->picture != None)
+        info->n_painted_windows++;
+
+      if (cw->mask == None)
+        cw->mask = get_window_mask (cw);
+
+      if (cw->window_region == NULL)
         cw->window_region = get_window_region (cw);
 
-      if (cw->visible_region == None)
+      if (cw->visible_region == NULL)
         cw->visible_region = get_visible_region (cw);
 
-      if (cw->client_region == None)
+      if (cw->client_region == NULL)
         cw->client_region = get_client_region (cw);
 
-      if (cw->extents == None)
-        cw->extents = win_extents (cw);
-
       if (cw->mode == WINDOW_SOLID)
         {
           int x, y, wid, hei;
@@ -1602,8 +1943,7 @@ paint_windows (MetaScreen   *screen,
           frame = cw->window ? meta_window_get_frame (cw->window) : NULL;
           meta_frame_calc_borders (frame, &borders);
 
-          XFixesSetPictureClipRegion (xdisplay, root_buffer,
-                                      0, 0, paint_region);
+          set_picture_clip_region (xdisplay, root_buffer, paint_region);
           XRenderComposite (xdisplay, PictOpSrc, cw->picture, None, root_buffer,
                             borders.total.left, borders.total.top, 0, 0,
                             x + borders.total.left, y + borders.total.top,
@@ -1612,36 +1952,29 @@ paint_windows (MetaScreen   *screen,
 
           if (cw->type == META_COMP_WINDOW_DESKTOP)
             {
-              desktop_region = XFixesCreateRegion (xdisplay, 0, 0);
-              XFixesCopyRegion (xdisplay, desktop_region, paint_region);
+              if (desktop_region != NULL)
+                cairo_region_destroy (desktop_region);
+
+              desktop_region = cairo_region_copy (paint_region);
             }
 
           if (frame == NULL)
-            {
-              XFixesSubtractRegion (xdisplay, paint_region,
-                                    paint_region, cw->window_region);
-            }
+            cairo_region_subtract (paint_region, cw->window_region);
           else
-            {
-              XFixesSubtractRegion (xdisplay, paint_region,
-                                    paint_region, cw->client_region);
-            }
+            cairo_region_subtract (paint_region, cw->client_region);
         }
 
       if (!cw->border_clip)
-        {
-          cw->border_clip = XFixesCreateRegion (xdisplay, 0, 0);
-          XFixesCopyRegion (xdisplay, cw->border_clip, paint_region);
-        }
+        cw->border_clip = cairo_region_copy (paint_region);
     }
 
-  XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, paint_region);
+  set_picture_clip_region (xdisplay, root_buffer, paint_region);
   paint_root (screen, root_buffer);
 
-  paint_dock_shadows (screen, root_buffer, desktop_region == None ?
+  paint_dock_shadows (screen, root_buffer, desktop_region == NULL ?
                       paint_region : desktop_region);
-  if (desktop_region != None)
-    XFixesDestroyRegion (xdisplay, desktop_region);
+  if (desktop_region != NULL)
+    cairo_region_destroy (desktop_region);
 
   /*
    * Painting from bottom to top, translucent windows and shadows are painted
@@ -1650,7 +1983,7 @@ paint_windows (MetaScreen   *screen,
     {
       cw = (MetaCompWindow *) index->data;
 
-      if (cw->picture)
+      if (cw->picture && cw->border_clip)
         {
           int x, y, wid, hei;
 
@@ -1661,34 +1994,27 @@ paint_windows (MetaScreen   *screen,
 
           if (cw->shadow && cw->type != META_COMP_WINDOW_DOCK)
             {
-              XserverRegion shadow_clip;
+              cairo_region_t *shadow_clip;
 
-              shadow_clip = XFixesCreateRegion (xdisplay, NULL, 0);
-              XFixesSubtractRegion (xdisplay, shadow_clip, cw->border_clip,
-                                    cw->visible_region);
-              XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0,
-                                          shadow_clip);
+              shadow_clip = cairo_region_copy (cw->border_clip);
+              cairo_region_subtract (shadow_clip, cw->visible_region);
+              set_picture_clip_region (xdisplay, root_buffer, shadow_clip);
 
               XRenderComposite (xdisplay, PictOpOver, info->black_picture,
                                 cw->shadow, root_buffer, 0, 0, 0, 0,
                                 x + cw->shadow_dx, y + cw->shadow_dy,
                                 cw->shadow_width, cw->shadow_height);
 
-              if (shadow_clip)
-                XFixesDestroyRegion (xdisplay, shadow_clip);
+              cairo_region_destroy (shadow_clip);
+
+              info->n_painted_shadows++;
             }
 
           if ((cw->opacity != (guint) OPAQUE) && !(cw->alpha_pict))
-            {
-              cw->alpha_pict = solid_picture (display, screen, FALSE,
-                                              (double) cw->opacity / OPAQUE,
-                                              0, 0, 0);
-            }
+            cw->alpha_pict = info->alpha_pictures[cw->opacity >> 24];
 
-          XFixesIntersectRegion (xdisplay, cw->border_clip, cw->border_clip,
-                                 cw->window_region);
-          XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0,
-                                      cw->border_clip);
+          cairo_region_intersect (cw->border_clip, cw->window_region);
+          set_picture_clip_region (xdisplay, root_buffer, cw->border_clip);
 
           if (cw->mode == WINDOW_SOLID && cw->mask != None)
             {
@@ -1702,14 +2028,11 @@ paint_windows (MetaScreen   *screen,
             }
           else if (cw->mode == WINDOW_ARGB && cw->mask != None)
             {
-              XserverRegion clip;
-              XserverRegion client;
+              cairo_region_t *clip;
 
-              clip = XFixesCreateRegion (xdisplay, NULL, 0);
-              client = cw->client_region;
-
-              XFixesSubtractRegion (xdisplay, clip, cw->border_clip, client);
-              XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, clip);
+              clip = cairo_region_copy (cw->border_clip);
+              cairo_region_subtract (clip, cw->client_region);
+              set_picture_clip_region (xdisplay, root_buffer, clip);
 
               XRenderComposite (xdisplay, PictOpOver, cw->mask,
                                 cw->alpha_pict, root_buffer, 0, 0, 0, 0,
@@ -1719,15 +2042,17 @@ paint_windows (MetaScreen   *screen,
                                 None, root_buffer, 0, 0, 0, 0,
                                 x, y, wid, hei);
 
-              XFixesIntersectRegion (xdisplay, clip, cw->border_clip, client);
-              XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, clip);
+              cairo_region_destroy (clip);
+
+              clip = cairo_region_copy (cw->border_clip);
+              cairo_region_intersect (clip, cw->client_region);
+              set_picture_clip_region (xdisplay, root_buffer, clip);
 
               XRenderComposite (xdisplay, PictOpOver, cw->picture,
                                 cw->alpha_pict, root_buffer, 0, 0, 0, 0,
                                 x, y, wid, hei);
 
-              if (clip)
-                XFixesDestroyRegion (xdisplay, clip);
+              cairo_region_destroy (clip);
             }
           else if (cw->mode == WINDOW_ARGB && cw->mask == None)
             {
@@ -1739,12 +2064,107 @@ paint_windows (MetaScreen   *screen,
 
       if (cw->border_clip)
         {
-          XFixesDestroyRegion (xdisplay, cw->border_clip);
-          cw->border_clip = None;
+          cairo_region_destroy (cw->border_clip);
+          cw->border_clip = NULL;
         }
     }
 
-  XFixesDestroyRegion (xdisplay, paint_region);
+  cairo_region_destroy (paint_region);
+
+  meta_topic (META_DEBUG_COMPOSITOR, "Culled %d occluded windows\n", n_culled);
+}
+
+static int
+get_bytes_per_pixel (MetaScreen *screen)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  int depth;
+
+  depth = DefaultDepth (xdisplay, meta_screen_get_screen_number (screen));
+
+  if (depth > 16)
+    return 4;
+  else if (depth > 8)
+    return 2;
+
+  return 1;
+}
+
+static guint64
+get_region_area (cairo_region_t *region)
+{
+  cairo_rectangle_int_t rect;
+  guint64 area;
+  int n_rects, i;
+
+  area = 0;
+  n_rects = cairo_region_num_rectangles (region);
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_region_get_rectangle (region, i, &rect);
+      area += (guint64) rect.width * rect.height;
+    }
+
+  return area;
+}
+
+/* Copies the damaged part of the back buffer to the screen, returns the
+ * number of bytes moved.
+ */
+static guint64
+present_damage (MetaScreen     *screen,
+                cairo_region_t *damage)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  cairo_rectangle_int_t rect;
+  int n_rects, i;
+
+  n_rects = cairo_region_num_rectangles (damage);
+  if (n_rects == 0)
+    return 0;
+
+  if (n_rects > MAX_PRESENT_RECTANGLES)
+    {
+      /* Many small rectangles, let the server clip a single copy */
+      set_picture_clip_region (xdisplay, info->root_buffer, damage);
+      set_picture_clip_region (xdisplay, info->root_picture, damage);
+
+      cairo_region_get_extents (damage, &rect);
+      XRenderComposite (xdisplay, PictOpSrc, info->root_buffer, None,
+                        info->root_picture, rect.x, rect.y, 0, 0,
+                        rect.x, rect.y, rect.width, rect.height);
+    }
+  else
+    {
+      XFixesSetPictureClipRegion (xdisplay, info->root_buffer, 0, 0, None);
+      XFixesSetPictureClipRegion (xdisplay, info->root_picture, 0, 0, None);
+
+      for (i = 0; i < n_rects; i++)
+        {
+          cairo_region_get_rectangle (damage, i, &rect);
+          XRenderComposite (xdisplay, PictOpSrc, info->root_buffer, None,
+                            info->root_picture, rect.x, rect.y, 0, 0,
+                            rect.x, rect.y, rect.width, rect.height);
+        }
+    }
+
+  return get_region_area (damage) * get_bytes_per_pixel (screen);
+}
+
+/* CPU time used by the calling thread, in microseconds */
+static gint64
+get_thread_cpu_time (void)
+{
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0;
+
+  return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
 }
 
 static void
@@ -1756,12 +2176,58 @@ paint_all (MetaCompositorXRender *xrender,
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
   int screen_width, screen_height;
+  cairo_region_t *damage;
+  MetaFrameStats *stats;
+  gint64 start_cpu_time;
+  gint64 start_time;
+  gulong start_request;
 
-  /* Set clipping to the given region */
-  XFixesSetPictureClipRegion (xdisplay, info->root_picture, 0, 0, region);
+  start_cpu_time = get_thread_cpu_time ();
+  start_time = g_get_monotonic_time ();
+  start_request = NextRequest (xdisplay);
+
+  info->n_painted_windows = 0;
+  info->n_painted_shadows = 0;
 
   meta_screen_get_size (screen, &screen_width, &screen_height);
 
+  if (info->root_buffer == None)
+    {
+      info->root_buffer = create_root_buffer (screen);
+      info->root_buffer_age = 0;
+    }
+
+  /* Only the damaged area of the back buffer is repainted and copied to
+   * the screen, the rest still holds the previous frame. A new buffer has
+   * undefined contents, so it is painted in full.
+   */
+  damage = NULL;
+  if (info->root_buffer_age > 0)
+    damage = xserver_region_to_cairo_region (xdisplay, region);
+
+  if (damage == NULL)
+    {
+      cairo_rectangle_int_t r;
+
+      r.x = 0;
+      r.y = 0;
+      r.width = screen_width;
+      r.height = screen_height;
+      damage = cairo_region_create_rectangle (&r);
+    }
+
+  /* The output of an unredirected window is not ours to paint */
+  if (info->unredirected_window != NULL)
+    {
+      cairo_region_subtract_rectangle (damage, &info->unredirected_rect);
+
+      if (cairo_region_is_empty (damage))
+        {
+          cairo_region_destroy (damage);
+          return;
+        }
+    }
+
   if (xrender->show_redraw)
     {
       Picture overlay;
@@ -1774,6 +2240,7 @@ paint_all (MetaCompositorXRender *xrender,
                                ((double) (rand () % 100)) / 100.0,
                                ((double) (rand () % 100)) / 100.0);
 
+      set_picture_clip_region (xdisplay, info->root_picture, damage);
       XRenderComposite (xdisplay, PictOpOver, overlay, None, info->root_picture,
                         0, 0, 0, 0, 0, 0, screen_width, screen_height);
       XRenderFreePicture (xdisplay, overlay);
@@ -1781,26 +2248,368 @@ paint_all (MetaCompositorXRender *xrender,
       usleep (100 * 1000);
     }
 
-  if (info->root_buffer == None)
-    info->root_buffer = create_root_buffer (screen);
+  paint_windows (screen, info->windows, info->root_buffer, damage);
+
+  xrender->frame_bytes = present_damage (screen, damage);
+  xrender->presented_bytes += xrender->frame_bytes;
+  info->root_buffer_age++;
+
+  stats = &xrender->frame_stats[xrender->next_frame_stats];
+  stats->cpu_time = get_thread_cpu_time () - start_cpu_time;
+  stats->wall_time = g_get_monotonic_time () - start_time;
+  stats->requests = NextRequest (xdisplay) - start_request;
+  stats->windows = info->n_painted_windows;
+  stats->shadows = info->n_painted_shadows;
+  stats->damaged_area = get_region_area (damage);
 
-  paint_windows (screen, info->windows, info->root_buffer, region);
+  xrender->next_frame_stats = (xrender->next_frame_stats + 1) % FRAME_STATS_SIZE;
+  if (xrender->n_frame_stats < FRAME_STATS_SIZE)
+    xrender->n_frame_stats++;
 
-  XFixesSetPictureClipRegion (xdisplay, info->root_buffer, 0, 0, region);
-  XRenderComposite (xdisplay, PictOpSrc, info->root_buffer, None,
-                    info->root_picture, 0, 0, 0, 0, 0, 0,
-                    screen_width, screen_height);
+  cairo_region_destroy (damage);
 }
 
+/* Looks for a window that can be drawn by the X server directly on the
+ * given output: the topmost visible window there has to be solid and
+ * fullscreen, cover the whole output and show nowhere else.
+ */
+static MetaCompWindow *
+find_unredirect_candidate_on_output (MetaScreen                  *screen,
+                                     const cairo_rectangle_int_t *output)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  cairo_rectangle_int_t screen_rect;
+  GList *index;
+
+  screen_rect.x = 0;
+  screen_rect.y = 0;
+  meta_screen_get_size (screen, &screen_rect.width, &screen_rect.height);
+
+  for (index = info->windows; index; index = index->next)
+    {
+      MetaCompWindow *cw = (MetaCompWindow *) index->data;
+      cairo_rectangle_int_t bounds;
+      cairo_region_t *shown;
+      gboolean inside;
+
+      if (cw->attrs.map_state != IsViewable || cw->attrs.class == InputOnly)
+        continue;
+
+      bounds.x = cw->attrs.x;
+      bounds.y = cw->attrs.y;
+      bounds.width = cw->attrs.width + cw->attrs.border_width * 2;
+      bounds.height = cw->attrs.height + cw->attrs.border_width * 2;
+
+      /* Windows on other outputs don't matter */
+      if (bounds.x >= output->x + output->width ||
+          bounds.y >= output->y + output->height ||
+          bounds.x + bounds.width <= output->x ||
+          bounds.y + bounds.height <= output->y)
+        continue;
+
+      /* Only the topmost visible window on the output is considered */
+      if (cw->mode != WINDOW_SOLID || cw->shaped)
+        return NULL;
+
+      if (cw->window && !meta_window_is_fullscreen (cw->window))
+        return NULL;
+
+      if (bounds.x > output->x || bounds.y > output->y ||
+          bounds.x + bounds.width < output->x + output->width ||
+          bounds.y + bounds.height < output->y + output->height)
+        return NULL;
+
+      /* The part of the window on the screen has to be on this output,
+       * the overlay window stays in place elsewhere
+       */
+      shown = cairo_region_create_rectangle (&bounds);
+      cairo_region_intersect_rectangle (shown, &screen_rect);
+      cairo_region_subtract_rectangle (shown, output);
+      inside = cairo_region_is_empty (shown);
+      cairo_region_destroy (shown);
+
+      return inside ? cw : NULL;
+    }
+
+  return NULL;
+}
+
+static MetaCompWindow *
+find_unredirect_candidate (MetaScreen            *screen,
+                           cairo_rectangle_int_t *output_rect)
+{
+  int n_outputs;
+  int i;
+
+  n_outputs = meta_screen_get_n_xineramas (screen);
+
+  for (i = 0; i < n_outputs; i++)
+    {
+      MetaRectangle geometry;
+      MetaCompWindow *cw;
+
+      meta_screen_get_xinerama_geometry (screen, i, &geometry);
+
+      output_rect->x = geometry.x;
+      output_rect->y = geometry.y;
+      output_rect->width = geometry.width;
+      output_rect->height = geometry.height;
+
+      cw = find_unredirect_candidate_on_output (screen, output_rect);
+      if (cw != NULL)
+        return cw;
+    }
+
+  return NULL;
+}
+
+static void
+unredirect_window (MetaScreen                  *screen,
+                   MetaCompWindow              *cw,
+                   const cairo_rectangle_int_t *output_rect)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  XserverRegion region;
+  XserverRegion hole;
+  XRectangle r;
+  int width, height;
+
+  meta_verbose ("Unredirecting fullscreen window 0x%lx on output "
+                "%d,%d %dx%d\n", cw->id, output_rect->x, output_rect->y,
+                output_rect->width, output_rect->height);
+
+  meta_error_trap_push (display);
+  XCompositeUnredirectWindow (xdisplay, cw->id, CompositeRedirectManual);
+  meta_error_trap_pop (display);
+
+  /* Cut a hole in the overlay window so that the window shows through,
+   * the other outputs are still composited
+   */
+  r.x = 0;
+  r.y = 0;
+  meta_screen_get_size (screen, &width, &height);
+  r.width = width;
+  r.height = height;
+  region = XFixesCreateRegion (xdisplay, &r, 1);
+
+  r.x = output_rect->x;
+  r.y = output_rect->y;
+  r.width = output_rect->width;
+  r.height = output_rect->height;
+  hole = XFixesCreateRegion (xdisplay, &r, 1);
+
+  XFixesSubtractRegion (xdisplay, region, region, hole);
+  XFixesSetWindowShapeRegion (xdisplay, info->output, ShapeBounding,
+                              0, 0, region);
+
+  XFixesDestroyRegion (xdisplay, hole);
+  XFixesDestroyRegion (xdisplay, region);
+
+  info->unredirected_window = cw;
+  info->unredirected_rect = *output_rect;
+}
+
+/* Hands the unredirected window back to the compositor. The whole screen
+ * is damaged as nothing has been painted to the overlay window while it
+ * was hidden.
+ */
+static void
+redirect_window (MetaScreen *screen,
+                 gboolean    destroyed)
+{
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaCompWindow *cw;
+  XRectangle r;
+  int width, height;
+
+  cw = info->unredirected_window;
+  if (cw == NULL)
+    return;
+
+  meta_verbose ("Redirecting window 0x%lx\n", cw->id);
+
+  if (!destroyed)
+    {
+      meta_error_trap_push (display);
+
+      XCompositeRedirectWindow (xdisplay, cw->id, CompositeRedirectManual);
+
+      /* The named pixmap does not follow the new redirection */
+      if (cw->picture)
+        {
+          XRenderFreePicture (xdisplay, cw->picture);
+          cw->picture = None;
+        }
+
+      if (cw->back_pixmap)
+        {
+          XFreePixmap (xdisplay, cw->back_pixmap);
+          cw->back_pixmap = None;
+        }
+
+      meta_error_trap_pop (display);
+    }
+
+  info->unredirected_window = NULL;
+
+  XFixesSetWindowShapeRegion (xdisplay, info->output, ShapeBounding,
+                              0, 0, None);
+
+  r.x = 0;
+  r.y = 0;
+  meta_screen_get_size (screen, &width, &height);
+  r.width = width;
+  r.height = height;
+
+  if (info->all_damage != None)
+    XFixesDestroyRegion (xdisplay, info->all_damage);
+
+  info->all_damage = XFixesCreateRegion (xdisplay, &r, 1);
+  info->clip_changed = TRUE;
+}
+
+static XserverRegion
+fetch_window_damage (MetaCompositorXRender *xrender,
+                     MetaCompWindow        *cw)
+{
+  MetaCompositor *compositor = META_COMPOSITOR (xrender);
+  MetaDisplay *display = meta_compositor_get_display (compositor);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  XserverRegion parts;
+
+  meta_error_trap_push (NULL);
+
+  if (!cw->damaged)
+    {
+      parts = win_extents (cw);
+      XDamageSubtract (xdisplay, cw->damage, None, None);
+    }
+  else if (cw->damage_level == XDamageReportBoundingBox)
+    {
+      XRectangle r;
+
+      r.x = cw->damage_bounds.x + cw->attrs.x + cw->attrs.border_width;
+      r.y = cw->damage_bounds.y + cw->attrs.y + cw->attrs.border_width;
+      r.width = cw->damage_bounds.width;
+      r.height = cw->damage_bounds.height;
+
+      XDamageSubtract (xdisplay, cw->damage, None, None);
+      parts = XFixesCreateRegion (xdisplay, &r, 1);
+    }
+  else
+    {
+      parts = XFixesCreateRegion (xdisplay, 0, 0);
+      XDamageSubtract (xdisplay, cw->damage, None, parts);
+      XFixesTranslateRegion (xdisplay, parts,
+                             cw->attrs.x + cw->attrs.border_width,
+                             cw->attrs.y + cw->attrs.border_width);
+    }
+
+  meta_error_trap_pop (NULL);
+
+  cw->damage_bounds.width = 0;
+  cw->damage_bounds.height = 0;
+
+  dump_xserver_region (xrender, "fetch_window_damage", parts);
+  cw->damaged = TRUE;
+
+  return parts;
+}
+
+/* Fetches the damage of all windows that were notified since the last
+ * frame. Until then the server sends no further notifies for
+ * XDamageReportNonEmpty, so a busy window costs one notify per frame.
+ */
 static void
+repair_pending_windows (MetaCompositorXRender *xrender,
+                        MetaScreen            *screen)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  GList *index;
+
+  for (index = info->windows; index; index = index->next)
+    {
+      MetaCompWindow *cw = (MetaCompWindow *) index->data;
+
+      if (!cw->damage_pending)
+        continue;
+
+      cw->damage_pending = FALSE;
+
+      if (cw->damage != None)
+        {
+          XserverRegion parts;
+
+          parts = fetch_window_damage (xrender, cw);
+
+          if (info->all_damage != None)
+            {
+              XFixesUnionRegion (xdisplay, info->all_damage,
+                                 info->all_damage, parts);
+              XFixesDestroyRegion (xdisplay, parts);
+            }
+          else
+            info->all_damage = parts;
+        }
+    }
+}
+
+static gboolean
 repair_screen (MetaCompositorXRender *xrender,
                MetaScreen            *screen)
 {
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
+  MetaCompWindow *candidate;
+  cairo_rectangle_int_t output_rect;
+  int screen_width, screen_height;
+
+  if (info == NULL)
+    return FALSE;
+
+  repair_pending_windows (xrender, screen);
+
+  candidate = find_unredirect_candidate (screen, &output_rect);
+  if (candidate != info->unredirected_window ||
+      (candidate != NULL &&
+       (output_rect.x != info->unredirected_rect.x ||
+        output_rect.y != info->unredirected_rect.y ||
+        output_rect.width != info->unredirected_rect.width ||
+        output_rect.height != info->unredirected_rect.height)))
+    {
+      redirect_window (screen, FALSE);
+
+      if (candidate != NULL)
+        unredirect_window (screen, candidate, &output_rect);
+    }
+
+  meta_screen_get_size (screen, &screen_width, &screen_height);
+
+  if (info->unredirected_window != NULL &&
+      info->unredirected_rect.x <= 0 && info->unredirected_rect.y <= 0 &&
+      info->unredirected_rect.x + info->unredirected_rect.width >= screen_width &&
+      info->unredirected_rect.y + info->unredirected_rect.height >= screen_height)
+    {
+      /* The X server draws the whole screen, nothing to repaint. With
+       * more outputs, paint_all() leaves out the unredirected one.
+       */
+      if (info->all_damage != None)
+        {
+          XFixesDestroyRegion (xdisplay, info->all_damage);
+          info->all_damage = None;
+        }
+
+      return FALSE;
+    }
 
-  if (info!=NULL && info->all_damage != None)
+  if (info->all_damage != None)
     {
       meta_error_trap_push (display);
       paint_all (xrender, screen, info->all_damage);
@@ -1808,7 +2617,11 @@ repair_screen (MetaCompositorXRender *xrender,
       info->all_damage = None;
       info->clip_changed = FALSE;
       meta_error_trap_pop (display);
+
+      return TRUE;
     }
+
+  return FALSE;
 }
 
 static void
@@ -1826,7 +2639,63 @@ repair_display (MetaCompositorXRender *xrender)
     }
 #endif
 
-  repair_screen (xrender, screen);
+  if (!repair_screen (xrender, screen))
+    return;
+
+  xrender->last_frame_time = g_get_monotonic_time ();
+  xrender->frames_drawn++;
+
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Frame %" G_GUINT64_FORMAT ": %u damage events folded "
+              "(%" G_GUINT64_FORMAT " damage events in total)\n",
+              xrender->frames_drawn, xrender->frame_damage_events,
+              xrender->damage_events);
+
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Frame %" G_GUINT64_FORMAT ": %" G_GUINT64_FORMAT " bytes "
+              "presented (%" G_GUINT64_FORMAT " bytes in total)\n",
+              xrender->frames_drawn, xrender->frame_bytes,
+              xrender->presented_bytes);
+
+  xrender->frame_damage_events = 0;
+}
+
+static gint64
+get_frame_interval (MetaScreen *screen)
+{
+  const gchar *rate_string;
+  int rate;
+
+  rate = 0;
+  rate_string = g_getenv ("METACITY_COMPOSITOR_REFRESH_RATE");
+
+  if (rate_string != NULL)
+    rate = atoi (rate_string);
+
+#ifdef HAVE_RANDR
+  if (rate <= 0)
+    {
+      MetaDisplay *display = meta_screen_get_display (screen);
+      Display *xdisplay = meta_display_get_xdisplay (display);
+      Window xroot = meta_screen_get_xroot (screen);
+      XRRScreenConfiguration *config;
+
+      config = XRRGetScreenInfo (xdisplay, xroot);
+
+      if (config != NULL)
+        {
+          rate = XRRConfigCurrentRate (config);
+          XRRFreeScreenConfigInfo (config);
+        }
+    }
+#endif
+
+  if (rate <= 0)
+    rate = DEFAULT_REFRESH_RATE;
+
+  meta_verbose ("Compositor refresh rate is %d Hz\n", rate);
+
+  return G_USEC_PER_SEC / rate;
 }
 
 #ifdef USE_IDLE_REPAINT
@@ -1844,19 +2713,35 @@ compositor_idle_cb (gpointer data)
 static void
 add_repair (MetaCompositorXRender *xrender)
 {
+  gint64 now;
+  gint64 next_frame_time;
+
+  /* Any damage arriving before the pending frame is drawn gets folded
+   * into all_damage and painted with that frame.
+   */
   if (xrender->repaint_id > 0)
     return;
 
-#if 1
-  xrender->repaint_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
-                                         compositor_idle_cb, xrender,
-                                         NULL);
-#else
-  /* Limit it to 50fps */
-  xrender->repaint_id = g_timeout_add_full (G_PRIORITY_HIGH, 20,
-                                            compositor_idle_cb, xrender,
-                                            NULL);
-#endif
+  now = g_get_monotonic_time ();
+  next_frame_time = xrender->last_frame_time + xrender->frame_interval;
+
+  if (now >= next_frame_time)
+    {
+      /* We have been idle for at least one frame, so paint right away */
+      xrender->repaint_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                             compositor_idle_cb, xrender,
+                                             NULL);
+    }
+  else
+    {
+      guint delay;
+
+      /* Wait for the next frame slot, rounding up to whole milliseconds */
+      delay = (next_frame_time - now + 999) / 1000;
+      xrender->repaint_id = g_timeout_add_full (G_PRIORITY_HIGH_IDLE, delay,
+                                                compositor_idle_cb, xrender,
+                                                NULL);
+    }
 }
 #endif
 
@@ -1908,36 +2793,126 @@ damage_screen (MetaCompositorXRender *xrender,
 }
 
 static void
-repair_win (MetaCompositorXRender *xrender,
-            MetaCompWindow        *cw)
+drop_cached_resources (MetaCompWindow *cw)
 {
-  MetaScreen *screen = cw->screen;
-  MetaCompositor *compositor = META_COMPOSITOR (xrender);
-  MetaDisplay *display = meta_compositor_get_display (compositor);
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
-  XserverRegion parts;
+  MetaCompScreen *info = meta_screen_get_compositor_data (cw->screen);
 
-  meta_error_trap_push (NULL);
+  if (cw->cached.link == NULL)
+    return;
 
-  if (!cw->damaged)
+  if (info != NULL)
     {
-      parts = win_extents (cw);
-      XDamageSubtract (xdisplay, cw->damage, None, None);
+      g_queue_delete_link (&info->cached_windows, cw->cached.link);
+      info->cached_size -= cw->cached.size;
     }
-  else
+
+  cw->cached.link = NULL;
+  cw->cached.size = 0;
+
+  meta_error_trap_push (display);
+
+  if (cw->cached.mask)
     {
-      parts = XFixesCreateRegion (xdisplay, 0, 0);
-      XDamageSubtract (xdisplay, cw->damage, None, parts);
-      XFixesTranslateRegion (xdisplay, parts,
-                             cw->attrs.x + cw->attrs.border_width,
-                             cw->attrs.y + cw->attrs.border_width);
+      XRenderFreePicture (xdisplay, cw->cached.mask);
+      cw->cached.mask = None;
     }
 
-  meta_error_trap_pop (NULL);
+  if (cw->cached.shadow)
+    {
+      XRenderFreePicture (xdisplay, cw->cached.shadow);
+      cw->cached.shadow = None;
+    }
 
-  dump_xserver_region (xrender, "repair_win", parts);
-  add_damage (xrender, screen, parts);
-  cw->damaged = TRUE;
+  meta_error_trap_pop (display);
+
+  if (cw->cached.shadow_entry)
+    {
+      shadow_cache_entry_unref (cw->screen, cw->cached.shadow_entry);
+      cw->cached.shadow_entry = NULL;
+    }
+}
+
+static void
+cache_window_resources (MetaCompWindow *cw)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+  drop_cached_resources (cw);
+
+  if (info == NULL || (cw->mask == None && cw->shadow == None))
+    return;
+
+  cw->cached.width = cw->attrs.width + cw->attrs.border_width * 2;
+  cw->cached.height = cw->attrs.height + cw->attrs.border_width * 2;
+  cw->cached.shadow_type = cw->shadow_type;
+  cw->cached.opacity = cw->opacity;
+  cw->cached.size = 0;
+
+  /* Both the mask and the shadow are A8 pictures */
+  cw->cached.mask = cw->mask;
+  cw->mask = None;
+
+  if (cw->cached.mask != None)
+    cw->cached.size += (gsize) cw->cached.width * cw->cached.height;
+
+  cw->cached.shadow = cw->shadow;
+  cw->cached.shadow_entry = cw->shadow_entry;
+  cw->cached.shadow_width = cw->shadow_width;
+  cw->cached.shadow_height = cw->shadow_height;
+  cw->shadow = None;
+  cw->shadow_entry = NULL;
+
+  if (cw->cached.shadow != None)
+    cw->cached.size += (gsize) cw->shadow_width * cw->shadow_height;
+
+  g_queue_push_head (&info->cached_windows, cw);
+  cw->cached.link = info->cached_windows.head;
+  info->cached_size += cw->cached.size;
+
+  /* Evict the windows that have been unmapped for the longest time */
+  while (info->cached_size > MAX_CACHED_RESOURCES_SIZE)
+    drop_cached_resources ((MetaCompWindow *) info->cached_windows.tail->data);
+}
+
+static void
+restore_cached_resources (MetaCompWindow *cw)
+{
+  int width, height;
+
+  if (cw->cached.link == NULL)
+    return;
+
+  width = cw->attrs.width + cw->attrs.border_width * 2;
+  height = cw->attrs.height + cw->attrs.border_width * 2;
+
+  if (cw->cached.width == width && cw->cached.height == height &&
+      cw->cached.shadow_type == cw->shadow_type &&
+      cw->cached.opacity == cw->opacity)
+    {
+      meta_topic (META_DEBUG_COMPOSITOR,
+                  "Reusing cached resources of window 0x%lx\n", cw->id);
+
+      if (cw->mask == None)
+        {
+          cw->mask = cw->cached.mask;
+          cw->cached.mask = None;
+        }
+
+      if (cw->shadow == None && cw->needs_shadow)
+        {
+          cw->shadow = cw->cached.shadow;
+          cw->shadow_entry = cw->cached.shadow_entry;
+          cw->shadow_width = cw->cached.shadow_width;
+          cw->shadow_height = cw->cached.shadow_height;
+          cw->cached.shadow = None;
+          cw->cached.shadow_entry = NULL;
+        }
+    }
+
+  /* Whatever could not be reused is freed */
+  drop_cached_resources (cw);
 }
 
 static void
@@ -1975,40 +2950,33 @@ free_win (MetaCompWindow *cw,
       cw->mask = None;
     }
 
-  if (cw->shadow)
-    {
-      XRenderFreePicture (xdisplay, cw->shadow);
-      cw->shadow = None;
-    }
+  free_shadow (cw);
 
-  if (cw->alpha_pict)
-    {
-      XRenderFreePicture (xdisplay, cw->alpha_pict);
-      cw->alpha_pict = None;
-    }
+  /* The alpha picture is shared, it belongs to the screen */
+  cw->alpha_pict = None;
 
   if (cw->window_region)
     {
-      XFixesDestroyRegion (xdisplay, cw->window_region);
-      cw->window_region = None;
+      cairo_region_destroy (cw->window_region);
+      cw->window_region = NULL;
     }
 
   if (cw->visible_region)
     {
-      XFixesDestroyRegion (xdisplay, cw->visible_region);
-      cw->visible_region = None;
+      cairo_region_destroy (cw->visible_region);
+      cw->visible_region = NULL;
     }
 
   if (cw->client_region && destroy)
     {
-      XFixesDestroyRegion (xdisplay, cw->client_region);
-      cw->client_region = None;
+      cairo_region_destroy (cw->client_region);
+      cw->client_region = NULL;
     }
 
   if (cw->border_clip)
     {
-      XFixesDestroyRegion (xdisplay, cw->border_clip);
-      cw->border_clip = None;
+      cairo_region_destroy (cw->border_clip);
+      cw->border_clip = NULL;
     }
 
   if (cw->extents)
@@ -2031,12 +2999,15 @@ free_win (MetaCompWindow *cw,
 
   if (cw->shaded.client_region && destroy)
     {
-      XFixesDestroyRegion (xdisplay, cw->shaded.client_region);
-      cw->shaded.client_region = None;
+      cairo_region_destroy (cw->shaded.client_region);
+      cw->shaded.client_region = NULL;
     }
 
   if (destroy)
     {
+      drop_cached_resources (cw);
+      drop_shape_rects (cw);
+
       if (cw->damage != None)
         {
           XDamageDestroy (xdisplay, cw->damage);
@@ -2065,6 +3036,8 @@ map_win (MetaDisplay *display,
   if (cw == NULL)
     return;
 
+  restore_cached_resources (cw);
+
   /* The reason we deallocate this here and not in unmap
      is so that we will still have a valid pixmap for
      whenever the window is unmapped */
@@ -2074,7 +3047,8 @@ map_win (MetaDisplay *display,
       cw->back_pixmap = None;
     }
 
-  if (cw->mask_pixmap)
+  /* A reused mask still draws into its pixmap */
+  if (cw->mask_pixmap && cw->mask == None)
     {
       XFreePixmap (xdisplay, cw->mask_pixmap);
       cw->mask_pixmap = None;
@@ -2082,10 +3056,15 @@ map_win (MetaDisplay *display,
 
   if (cw->client_region)
     {
-      XFixesDestroyRegion (xdisplay, cw->client_region);
-      cw->client_region = None;
+      cairo_region_destroy (cw->client_region);
+      cw->client_region = NULL;
     }
 
+  /* Shape changes made while the window was unmanaged may have been
+   * missed, since the core stops selecting ShapeNotify on unmanage.
+   */
+  drop_shape_rects (cw);
+
   if (cw->shaded.back_pixmap)
     {
       XFreePixmap (xdisplay, cw->shaded.back_pixmap);
@@ -2100,8 +3079,8 @@ map_win (MetaDisplay *display,
 
   if (cw->shaded.client_region)
     {
-      XFixesDestroyRegion (xdisplay, cw->shaded.client_region);
-      cw->shaded.client_region = None;
+      cairo_region_destroy (cw->shaded.client_region);
+      cw->shaded.client_region = NULL;
     }
 
   cw->attrs.map_state = IsViewable;
@@ -2124,6 +3103,14 @@ unmap_win (MetaCompositorXRender *xrender,
   if (cw->window && cw->window == info->focus_window)
     info->focus_window = NULL;
 
+  if (cw == info->unredirected_window)
+    {
+      redirect_window (screen, FALSE);
+#ifdef USE_IDLE_REPAINT
+      add_repair (xrender);
+#endif
+    }
+
   cw->attrs.map_state = IsUnmapped;
   cw->damaged = FALSE;
 
@@ -2134,6 +3121,7 @@ unmap_win (MetaCompositorXRender *xrender,
       cw->extents = None;
     }
 
+  cache_window_resources (cw);
   free_win (cw, FALSE);
   info->clip_changed = TRUE;
 }
@@ -2148,11 +3136,8 @@ determine_mode (MetaCompositorXRender *xrender,
   MetaDisplay *display = meta_compositor_get_display (compositor);
   Display *xdisplay = meta_display_get_xdisplay (display);
 
-  if (cw->alpha_pict)
-    {
-      XRenderFreePicture (xdisplay, cw->alpha_pict);
-      cw->alpha_pict = None;
-    }
+  /* The alpha picture is shared, it belongs to the screen */
+  cw->alpha_pict = None;
 
   if (cw->attrs.class == InputOnly)
     format = NULL;
@@ -2298,24 +3283,48 @@ add_win (MetaCompositorXRender *xrender,
   cw->damaged = FALSE;
   cw->shaped = is_shaped (display, xwindow);
 
+  /* The cached bounding shape is refreshed on ShapeNotify, which is
+   * only selected by the core for client windows.
+   */
+  if (meta_display_has_shape (display))
+    XShapeSelectInput (xdisplay, xwindow, ShapeNotifyMask);
+
   cw->shape_bounds.x = cw->attrs.x;
   cw->shape_bounds.y = cw->attrs.y;
   cw->shape_bounds.width = cw->attrs.width;
   cw->shape_bounds.height = cw->attrs.height;
 
+  cw->damage_level = XDamageReportNonEmpty;
   if (cw->attrs.class == InputOnly)
     cw->damage = None;
   else
-    cw->damage = XDamageCreate (xdisplay, xwindow, XDamageReportNonEmpty);
+    cw->damage = XDamageCreate (xdisplay, xwindow, cw->damage_level);
+
+  cw->damage_pending = FALSE;
+  cw->damage_bounds.x = 0;
+  cw->damage_bounds.y = 0;
+  cw->damage_bounds.width = 0;
+  cw->damage_bounds.height = 0;
+  cw->damage_rate_start = g_get_monotonic_time ();
+  cw->damage_notifies = 0;
+  cw->damage_rate = 0;
+  cw->total_damage_notifies = 0;
 
   cw->alpha_pict = None;
 
-  cw->window_region = None;
-  cw->visible_region = None;
-  cw->client_region = None;
+  cw->window_region = NULL;
+  cw->visible_region = NULL;
+  cw->client_region = NULL;
 
   cw->extents = None;
   cw->shadow = None;
+  cw->shadow_entry = NULL;
+
+  cw->cached.link = NULL;
+  cw->cached.mask = None;
+  cw->cached.shadow = None;
+  cw->cached.shadow_entry = NULL;
+  cw->cached.size = 0;
   cw->shadow_dx = 0;
   cw->shadow_dy = 0;
   cw->shadow_width = 0;
@@ -2328,7 +3337,7 @@ add_win (MetaCompositorXRender *xrender,
 
   cw->opacity = OPAQUE;
 
-  cw->border_clip = None;
+  cw->border_clip = NULL;
 
   cw->shaded.back_pixmap = None;
   cw->shaded.mask_pixmap = None;
@@ -2336,7 +3345,7 @@ add_win (MetaCompositorXRender *xrender,
   cw->shaded.y = 0;
   cw->shaded.width = 0;
   cw->shaded.height = 0;
-  cw->shaded.client_region = None;
+  cw->shaded.client_region = NULL;
 
   determine_mode (xrender, screen, cw);
   cw->needs_shadow = window_has_shadow (cw);
@@ -2386,6 +3395,14 @@ destroy_win (MetaCompositorXRender *xrender,
   info = meta_screen_get_compositor_data (screen);
   if (info != NULL)
     {
+      if (cw == info->unredirected_window)
+        {
+          redirect_window (screen, TRUE);
+#ifdef USE_IDLE_REPAINT
+          add_repair (xrender);
+#endif
+        }
+
       info->windows = g_list_remove (info->windows, (gconstpointer) cw);
       g_hash_table_remove (info->windows_by_xid, (gpointer) xwindow);
     }
@@ -2504,8 +3521,8 @@ resize_win (MetaCompositorXRender *xrender,
 
       if (cw->shaded.client_region)
         {
-          XFixesDestroyRegion (xdisplay, cw->shaded.client_region);
-          cw->shaded.client_region = None;
+          cairo_region_destroy (cw->shaded.client_region);
+          cw->shaded.client_region = NULL;
         }
 
       if (cw->back_pixmap)
@@ -2549,13 +3566,8 @@ resize_win (MetaCompositorXRender *xrender,
           cw->shaded.width = cw->attrs.width;
           cw->shaded.height = cw->attrs.height;
 
-          if (cw->client_region != None)
-            {
-              cw->shaded.client_region = XFixesCreateRegion (xdisplay, NULL, 0);
-
-              XFixesCopyRegion (xdisplay, cw->shaded.client_region,
-                                cw->client_region);
-            }
+          if (cw->client_region != NULL)
+            cw->shaded.client_region = cairo_region_copy (cw->client_region);
         }
 
       if (cw->picture)
@@ -2570,11 +3582,7 @@ resize_win (MetaCompositorXRender *xrender,
           cw->mask = None;
         }
 
-      if (cw->shadow)
-        {
-          XRenderFreePicture (xdisplay, cw->shadow);
-          cw->shadow = None;
-        }
+      free_shadow (cw);
     }
 
   cw->attrs.x = x;
@@ -2694,6 +3702,9 @@ process_configure_notify (MetaCompositorXRender *xrender,
           info->root_buffer = None;
         }
 
+      /* The mode, and with it the refresh rate, might have changed */
+      xrender->frame_interval = get_frame_interval (screen);
+
       damage_screen (xrender, screen);
     }
 }
@@ -2768,11 +3779,7 @@ process_property_notify (MetaCompositorXRender *xrender,
       determine_mode (xrender, cw->screen, cw);
       cw->needs_shadow = window_has_shadow (cw);
 
-      if (cw->shadow)
-        {
-          XRenderFreePicture (xdisplay, cw->shadow);
-          cw->shadow = None;
-        }
+      free_shadow (cw);
 
       if (cw->extents)
         XFixesDestroyRegion (xdisplay, cw->extents);
@@ -2875,7 +3882,17 @@ process_map (MetaCompositorXRender *xrender,
   MetaCompWindow *cw = find_window_in_display (display, event->window);
 
   if (cw)
-    map_win (display, cw->screen, event->window);
+    {
+      MetaCompScreen *info = meta_screen_get_compositor_data (cw->screen);
+
+      map_win (display, cw->screen, event->window);
+
+#ifdef USE_IDLE_REPAINT
+      /* A window mapped above an unredirected window needs compositing */
+      if (info != NULL && info->unredirected_window != NULL)
+        add_repair (xrender);
+#endif
+    }
 }
 
 static void
@@ -2922,6 +3939,66 @@ process_destroy (MetaCompositorXRender *xrender,
   destroy_win (xrender, event->window);
 }
 
+static void
+set_damage_level (MetaCompositorXRender *xrender,
+                  MetaCompWindow        *cw,
+                  int                    level)
+{
+  MetaCompositor *compositor = META_COMPOSITOR (xrender);
+  MetaDisplay *display = meta_compositor_get_display (compositor);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+
+  if (cw->damage == None || cw->damage_level == level)
+    return;
+
+  meta_error_trap_push (display);
+  XDamageDestroy (xdisplay, cw->damage);
+  cw->damage = XDamageCreate (xdisplay, cw->id, level);
+  meta_error_trap_pop (display);
+
+  cw->damage_level = level;
+  cw->damage_bounds.width = 0;
+  cw->damage_bounds.height = 0;
+
+  /* The new damage object starts empty, repaint what may have been lost */
+  if (cw->damaged)
+    add_damage (xrender, cw->screen, win_extents (cw));
+}
+
+static void
+update_damage_rate (MetaCompositorXRender *xrender,
+                    MetaCompWindow        *cw)
+{
+  gint64 now, elapsed;
+
+  cw->damage_notifies++;
+  cw->total_damage_notifies++;
+
+  now = g_get_monotonic_time ();
+  elapsed = now - cw->damage_rate_start;
+
+  if (elapsed < G_USEC_PER_SEC)
+    return;
+
+  cw->damage_rate = cw->damage_notifies * G_USEC_PER_SEC / elapsed;
+  cw->damage_notifies = 0;
+  cw->damage_rate_start = now;
+
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "Window 0x%lx: %u damage notifies per second, "
+              "%" G_GUINT64_FORMAT " in total, reporting %s\n",
+              cw->id, cw->damage_rate, cw->total_damage_notifies,
+              cw->damage_level == XDamageReportBoundingBox ?
+              "bounding box" : "non empty");
+
+  if (cw->damage_level == XDamageReportNonEmpty &&
+      cw->damage_rate < DAMAGE_RATE_LOW)
+    set_damage_level (xrender, cw, XDamageReportBoundingBox);
+  else if (cw->damage_level == XDamageReportBoundingBox &&
+           cw->damage_rate > DAMAGE_RATE_HIGH)
+    set_damage_level (xrender, cw, XDamageReportNonEmpty);
+}
+
 static void
 process_damage (MetaCompositorXRender *xrender,
                 XDamageNotifyEvent    *event)
@@ -2933,7 +4010,44 @@ process_damage (MetaCompositorXRender *xrender,
   if (cw == NULL)
     return;
 
-  repair_win (xrender, cw);
+  xrender->frame_damage_events++;
+  xrender->damage_events++;
+
+  /* Notifies from a damage object replaced by set_damage_level () carry
+   * no useful area, the new object covers them.
+   */
+  if (event->damage == cw->damage &&
+      event->level == XDamageReportBoundingBox)
+    {
+      cairo_rectangle_int_t *bounds = &cw->damage_bounds;
+
+      if (bounds->width == 0 || bounds->height == 0)
+        {
+          bounds->x = event->area.x;
+          bounds->y = event->area.y;
+          bounds->width = event->area.width;
+          bounds->height = event->area.height;
+        }
+      else
+        {
+          int x2, y2;
+
+          x2 = MAX (bounds->x + bounds->width,
+                    event->area.x + event->area.width);
+          y2 = MAX (bounds->y + bounds->height,
+                    event->area.y + event->area.height);
+
+          bounds->x = MIN (bounds->x, event->area.x);
+          bounds->y = MIN (bounds->y, event->area.y);
+          bounds->width = x2 - bounds->x;
+          bounds->height = y2 - bounds->y;
+        }
+    }
+
+  /* The damage is fetched once per frame in repair_screen () */
+  cw->damage_pending = TRUE;
+
+  update_damage_rate (xrender, cw);
 
 #ifdef USE_IDLE_REPAINT
   if (event->more == FALSE)
@@ -2954,6 +4068,8 @@ process_shape (MetaCompositorXRender *xrender,
 
   if (event->kind == ShapeBounding)
     {
+      drop_shape_rects (cw);
+
       if (!event->shaped && cw->shaped)
         cw->shaped = FALSE;
 
@@ -2990,21 +4106,133 @@ timeout_debug (MetaCompositorXRender *compositor)
   return FALSE;
 }
 
+static int
+compare_stats_values (const void *a,
+                      const void *b)
+{
+  gint64 value_a = *(const gint64 *) a;
+  gint64 value_b = *(const gint64 *) b;
+
+  if (value_a < value_b)
+    return -1;
+  else if (value_a > value_b)
+    return 1;
+
+  return 0;
+}
+
+static void
+append_percentiles (GString     *report,
+                    const gchar *name,
+                    gint64      *values,
+                    guint        n_values)
+{
+  qsort (values, n_values, sizeof (gint64), compare_stats_values);
+
+  g_string_append_printf (report,
+                          "%-20s min %8" G_GINT64_FORMAT
+                          "  p50 %8" G_GINT64_FORMAT
+                          "  p90 %8" G_GINT64_FORMAT
+                          "  p99 %8" G_GINT64_FORMAT
+                          "  max %8" G_GINT64_FORMAT "\n",
+                          name, values[0],
+                          values[n_values * 50 / 100],
+                          values[n_values * 90 / 100],
+                          values[n_values * 99 / 100],
+                          values[n_values - 1]);
+}
+
+static gchar *
+build_frame_stats_report (MetaCompositorXRender *xrender)
+{
+  static const gint64 bounds[] = { 250, 500, 1000, 2000, 4000, 8000, 16000 };
+  guint histogram[G_N_ELEMENTS (bounds) + 1];
+  GString *report;
+  gint64 *values;
+  guint n_frames, i, j;
+
+  n_frames = xrender->n_frame_stats;
+  report = g_string_new (NULL);
+
+  g_string_append_printf (report, "Last %u of %" G_GUINT64_FORMAT
+                          " frames, %" G_GUINT64_FORMAT " damage events, %"
+                          G_GUINT64_FORMAT " bytes presented\n\n",
+                          n_frames, xrender->frames_drawn,
+                          xrender->damage_events, xrender->presented_bytes);
+
+  if (n_frames == 0)
+    return g_string_free (report, FALSE);
+
+  values = g_new (gint64, n_frames);
+  memset (histogram, 0, sizeof (histogram));
+
+  for (i = 0; i < n_frames; i++)
+    {
+      values[i] = xrender->frame_stats[i].cpu_time;
+
+      j = 0;
+      while (j < G_N_ELEMENTS (bounds) && values[i] >= bounds[j])
+        j++;
+
+      histogram[j]++;
+    }
+  append_percentiles (report, "Paint CPU time (us)", values, n_frames);
+
+  for (i = 0; i < n_frames; i++)
+    values[i] = xrender->frame_stats[i].wall_time;
+  append_percentiles (report, "Paint wall time (us)", values, n_frames);
+
+  for (i = 0; i < n_frames; i++)
+    values[i] = xrender->frame_stats[i].requests;
+  append_percentiles (report, "X requests", values, n_frames);
+
+  for (i = 0; i < n_frames; i++)
+    values[i] = xrender->frame_stats[i].windows;
+  append_percentiles (report, "Windows painted", values, n_frames);
+
+  for (i = 0; i < n_frames; i++)
+    values[i] = xrender->frame_stats[i].shadows;
+  append_percentiles (report, "Shadows drawn", values, n_frames);
+
+  for (i = 0; i < n_frames; i++)
+    values[i] = xrender->frame_stats[i].damaged_area;
+  append_percentiles (report, "Damaged pixels", values, n_frames);
+
+  g_free (values);
+
+  g_string_append (report, "\nPaint CPU time histogram:\n");
+
+  for (j = 0; j < G_N_ELEMENTS (histogram); j++)
+    {
+      guint k;
+
+      if (j < G_N_ELEMENTS (bounds))
+        g_string_append_printf (report, "  < %6" G_GINT64_FORMAT " us %6u ",
+                                bounds[j], histogram[j]);
+      else
+        g_string_append_printf (report, " >= %6" G_GINT64_FORMAT " us %6u ",
+                                bounds[j - 1], histogram[j]);
+
+      for (k = 0; k < histogram[j] * 50 / n_frames; k++)
+        g_string_append_c (report, '#');
+
+      g_string_append_c (report, '\n');
+    }
+
+  return g_string_free (report, FALSE);
+}
+
 static void
 update_shadows (MetaPreference pref,
                 gpointer       data)
 {
   MetaCompScreen *info;
-  MetaDisplay *display;
-  Display *xdisplay;
   GList *index;
 
   if (pref != META_PREF_THEME_TYPE)
     return;
 
   info = (MetaCompScreen *) data;
-  display = meta_screen_get_display (info->screen);
-  xdisplay = meta_display_get_xdisplay (display);
 
   for (index = info->windows; index; index = index->next)
     {
@@ -3012,11 +4240,10 @@ update_shadows (MetaPreference pref,
 
       cw = (MetaCompWindow *) index->data;
 
-      if (cw->window && cw->shadow)
-        {
-          XRenderFreePicture (xdisplay, cw->shadow);
-          cw->shadow = None;
-        }
+      if (cw->window)
+        free_shadow (cw);
+
+      drop_cached_resources (cw);
 
       cw->needs_shadow = window_has_shadow (cw);
     }
@@ -3094,6 +4321,7 @@ meta_compositor_xrender_manage_screen (MetaCompositor *compositor,
   XRenderPictFormat *visual_format;
   int screen_number = meta_screen_get_screen_number (screen);
   Window xroot = meta_screen_get_xroot (screen);
+  int i;
 
   /* Check if the screen is already managed */
   if (meta_screen_get_compositor_data (screen))
@@ -3136,8 +4364,16 @@ meta_compositor_xrender_manage_screen (MetaCompositor *compositor,
     }
 
   info->root_buffer = None;
+  info->root_buffer_age = 0;
   info->black_picture = solid_picture (display, screen, TRUE, 1, 0, 0, 0);
 
+  for (i = 0; i < N_ALPHA_LEVELS; i++)
+    {
+      info->alpha_pictures[i] = solid_picture (display, screen, FALSE,
+                                               (double) i / (N_ALPHA_LEVELS - 1),
+                                               0, 0, 0);
+    }
+
   info->root_tile = None;
   info->all_damage = None;
 
@@ -3148,6 +4384,15 @@ meta_compositor_xrender_manage_screen (MetaCompositor *compositor,
 
   info->clip_changed = TRUE;
 
+  xrender->frame_interval = get_frame_interval (screen);
+  xrender->last_frame_time = 0;
+
+  info->shadow_cache = g_hash_table_new (shadow_cache_entry_hash,
+                                         shadow_cache_entry_equal);
+
+  g_queue_init (&info->cached_windows);
+  info->cached_size = 0;
+
   info->have_shadows = (g_getenv("META_DEBUG_NO_SHADOW") == NULL);
   if (info->have_shadows)
     {
@@ -3176,6 +4421,7 @@ meta_compositor_xrender_unmanage_screen (MetaCompositor *compositor,
   MetaCompScreen *info;
   Window xroot = meta_screen_get_xroot (screen);
   GList *index;
+  int i;
 
   info = meta_screen_get_compositor_data (screen);
 
@@ -3195,6 +4441,7 @@ meta_compositor_xrender_unmanage_screen (MetaCompositor *compositor,
     }
   g_list_free (info->windows);
   g_hash_table_destroy (info->windows_by_xid);
+  g_hash_table_destroy (info->shadow_cache);
 
   if (info->root_picture)
     XRenderFreePicture (xdisplay, info->root_picture);
@@ -3202,10 +4449,14 @@ meta_compositor_xrender_unmanage_screen (MetaCompositor *compositor,
   if (info->black_picture)
     XRenderFreePicture (xdisplay, info->black_picture);
 
-  if (info->have_shadows)
+  for (i = 0; i < N_ALPHA_LEVELS; i++)
     {
-      int i;
+      if (info->alpha_pictures[i])
+        XRenderFreePicture (xdisplay, info->alpha_pictures[i]);
+    }
 
+  if (info->have_shadows)
+    {
       for (i = 0; i < LAST_SHADOW_TYPE; i++)
         g_free (info->shadows[i]->gaussian_map);
     }
@@ -3339,7 +4590,6 @@ meta_compositor_xrender_get_window_surface (MetaCompositor *compositor,
   Pixmap mask_pixmap;
   int width;
   int height;
-  XserverRegion xclient_region;
   cairo_region_t *client_region;
   cairo_surface_t *back_surface;
   cairo_surface_t *window_surface;
@@ -3370,34 +4620,24 @@ meta_compositor_xrender_get_window_surface (MetaCompositor *compositor,
   if (frame != NULL && mask_pixmap == None)
     return NULL;
 
-  xclient_region = None;
+  client_region = NULL;
   if (shaded)
     {
-      if (cw->shaded.client_region != None)
+      if (cw->shaded.client_region != NULL)
         {
-          xclient_region = XFixesCreateRegion (xdisplay, NULL, 0);
-          XFixesCopyRegion (xdisplay, xclient_region, cw->shaded.client_region);
-          XFixesTranslateRegion (xdisplay, xclient_region,
-                                 -cw->shaded.x, -cw->shaded.y);
+          client_region = cairo_region_copy (cw->shaded.client_region);
+          cairo_region_translate (client_region, -cw->shaded.x, -cw->shaded.y);
         }
     }
   else
     {
-      if (cw->client_region != None)
+      if (cw->client_region != NULL)
         {
-          xclient_region = XFixesCreateRegion (xdisplay, NULL, 0);
-          XFixesCopyRegion (xdisplay, xclient_region, cw->client_region);
-          XFixesTranslateRegion (xdisplay, xclient_region,
-                                 -cw->attrs.x, -cw->attrs.y);
+          client_region = cairo_region_copy (cw->client_region);
+          cairo_region_translate (client_region, -cw->attrs.x, -cw->attrs.y);
         }
     }
 
-  if (frame != NULL && xclient_region == None)
-    return NULL;
-
-  client_region = xserver_region_to_cairo_region (xdisplay, xclient_region);
-  XFixesDestroyRegion (xdisplay, xclient_region);
-
   if (frame != NULL && client_region == NULL)
     return NULL;
 
@@ -3516,11 +4756,7 @@ meta_compositor_xrender_set_active_window (MetaCompositor *compositor,
               old_focus->mask = None;
             }
 
-          if (old_focus->shadow)
-            {
-              XRenderFreePicture (xdisplay, old_focus->shadow);
-              old_focus->shadow = None;
-            }
+          free_shadow (old_focus);
 
           if (old_focus->extents)
             {
@@ -3566,11 +4802,7 @@ meta_compositor_xrender_set_active_window (MetaCompositor *compositor,
           new_focus->mask = None;
         }
 
-      if (new_focus->shadow)
-        {
-          XRenderFreePicture (xdisplay, new_focus->shadow);
-          new_focus->shadow = None;
-        }
+      free_shadow (new_focus);
 
       if (new_focus->extents)
         {
@@ -3638,6 +4870,7 @@ meta_compositor_xrender_free_window (MetaCompositor *compositor,
   MetaFrame *frame;
   Window xwindow;
   MetaCompWindow *cw;
+  MetaCompScreen *info;
 
   xrender = META_COMPOSITOR_XRENDER (compositor);
   display = meta_compositor_get_display (compositor);
@@ -3652,6 +4885,15 @@ meta_compositor_xrender_free_window (MetaCompositor *compositor,
   if (cw == NULL)
     return;
 
+  info = meta_screen_get_compositor_data (cw->screen);
+  if (info != NULL && cw == info->unredirected_window)
+    {
+      redirect_window (cw->screen, FALSE);
+#ifdef USE_IDLE_REPAINT
+      add_repair (xrender);
+#endif
+    }
+
   cw->window = NULL;
   cw->attrs.map_state = IsUnmapped;
   cw->damaged = FALSE;
@@ -3663,6 +4905,8 @@ meta_compositor_xrender_free_window (MetaCompositor *compositor,
       cw->extents = None;
     }
 
+  /* The mask was drawn from the frame that is going away */
+  drop_cached_resources (cw);
   free_win (cw, FALSE);
 }
 
@@ -3694,6 +4938,12 @@ meta_compositor_xrender_unmaximize_window (MetaCompositor *compositor,
   cw->needs_shadow = window_has_shadow (cw);
 }
 
+static gchar *
+meta_compositor_xrender_get_stats_report (MetaCompositor *compositor)
+{
+  return build_frame_stats_report (META_COMPOSITOR_XRENDER (compositor));
+}
+
 static void
 meta_compositor_xrender_class_init (MetaCompositorXRenderClass *xrender_class)
 {
@@ -3716,6 +4966,7 @@ meta_compositor_xrender_class_init (MetaCompositorXRenderClass *xrender_class)
   compositor_class->free_window = meta_compositor_xrender_free_window;
   compositor_class->maximize_window = meta_compositor_xrender_maximize_window;
   compositor_class->unmaximize_window = meta_compositor_xrender_unmaximize_window;
+  compositor_class->get_stats_report = meta_compositor_xrender_get_stats_report;
 }
 
 static void
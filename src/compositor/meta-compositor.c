@@ -18,12 +18,18 @@
 
 #include "config.h"
 
+#include <signal.h>
+#include <glib-unix.h>
+
 #include "meta-compositor-none.h"
 #include "meta-compositor-xrender.h"
+#include "util.h"
 
 typedef struct
 {
   MetaDisplay *display;
+
+  guint        stats_signal_id;
 } MetaCompositorPrivate;
 
 enum
@@ -44,6 +50,40 @@ G_DEFINE_ABSTRACT_TYPE_WITH_CODE (MetaCompositor, meta_compositor, G_TYPE_OBJECT
                                   G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
                                                          initable_iface_init))
 
+static gboolean
+write_stats_cb (gpointer user_data)
+{
+  MetaCompositor *compositor;
+  MetaCompositorClass *compositor_class;
+  GError *error;
+  gchar *filename;
+  gchar *report;
+
+  compositor = META_COMPOSITOR (user_data);
+  compositor_class = META_COMPOSITOR_GET_CLASS (compositor);
+
+  filename = g_build_filename (g_get_user_runtime_dir (),
+                               "metacity-compositor-stats", NULL);
+  report = compositor_class->get_stats_report (compositor);
+
+  error = NULL;
+  if (g_file_set_contents (filename, report, -1, &error))
+    {
+      meta_verbose ("Wrote compositor statistics to %s\n", filename);
+    }
+  else
+    {
+      meta_warning ("Failed to write compositor statistics: %s\n",
+                    error->message);
+      g_error_free (error);
+    }
+
+  g_free (report);
+  g_free (filename);
+
+  return G_SOURCE_CONTINUE;
+}
+
 static gboolean
 meta_compositor_initable_init (GInitable     *initable,
                                GCancellable  *cancellable,
@@ -64,6 +104,24 @@ initable_iface_init (GInitableIface *iface)
   iface->init = meta_compositor_initable_init;
 }
 
+static void
+meta_compositor_finalize (GObject *object)
+{
+  MetaCompositor *compositor;
+  MetaCompositorPrivate *priv;
+
+  compositor = META_COMPOSITOR (object);
+  priv = meta_compositor_get_instance_private (compositor);
+
+  if (priv->stats_signal_id > 0)
+    {
+      g_source_remove (priv->stats_signal_id);
+      priv->stats_signal_id = 0;
+    }
+
+  G_OBJECT_CLASS (meta_compositor_parent_class)->finalize (object);
+}
+
 static void
 meta_compositor_get_property (GObject    *object,
                               guint       property_id,
@@ -130,6 +188,7 @@ meta_compositor_class_init (MetaCompositorClass *compositor_class)
 
   object_class = G_OBJECT_CLASS (compositor_class);
 
+  object_class->finalize = meta_compositor_finalize;
   object_class->get_property = meta_compositor_get_property;
   object_class->set_property = meta_compositor_set_property;
 
@@ -139,6 +198,15 @@ meta_compositor_class_init (MetaCompositorClass *compositor_class)
 static void
 meta_compositor_init (MetaCompositor *compositor)
 {
+  MetaCompositorPrivate *priv;
+
+  priv = meta_compositor_get_instance_private (compositor);
+
+  /* Installed whatever the compositor, so that SIGUSR1 never falls
+   * back to its default action of killing us.
+   */
+  priv->stats_signal_id = g_unix_signal_add (SIGUSR1, write_stats_cb,
+                                             compositor);
 }
 
 MetaCompositor *
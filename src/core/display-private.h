@@ -185,7 +185,15 @@ struct _MetaDisplay
   gboolean    grab_threshold_movement_reached; /* raise_on_click == FALSE.    */
   MetaResizePopup *grab_resize_popup;
   GTimeVal    grab_last_moveresize_time;
-  guint32     grab_motion_notify_time;
+  /* Latest motion event of a move or resize grab that hasn't been
+   * handled yet, because more events were already queued; see
+   * event_callback()
+   */
+  XEvent      grab_pending_motion;
+  gboolean    grab_has_pending_motion;
+  guint       grab_pending_motion_idle;
+  guint       grab_motion_events;
+  guint       grab_collapsed_motion_events;
   int         grab_wireframe_last_display_width;
   int         grab_wireframe_last_display_height;
   GList*      grab_old_window_stacking;
@@ -208,6 +216,11 @@ struct _MetaDisplay
   /* Keybindings stuff */
   MetaKeyBinding *key_bindings;
   int             n_key_bindings;
+  /* key_bindings by keycode and modifier mask, for dispatching key
+   * presses; the screen table leaves out the per-window bindings
+   */
+  GHashTable     *window_key_dispatch;
+  GHashTable     *screen_key_dispatch;
   int             min_keycode;
   int             max_keycode;
   KeySym *keymap;
@@ -241,6 +254,11 @@ struct _MetaDisplay
   MetaWindowPropHooks *prop_hooks_table;
   GHashTable *prop_hooks;
   int n_prop_hooks;
+  GSList *windows_with_pending_props;
+  guint pending_props_idle;
+  guint n_property_notifies;
+  guint n_collapsed_property_notifies;
+  guint n_property_batches;
 
   /* Managed by group-props.c */
   MetaGroupPropHooks *group_prop_hooks;
@@ -139,6 +139,8 @@ static void   meta_spew_event           (MetaDisplay    *display,
 
 static gboolean event_callback          (XEvent         *event,
                                          gpointer        data);
+static gboolean handle_event            (MetaDisplay    *display,
+                                         XEvent         *event);
 static Window event_get_modified_window (MetaDisplay    *display,
                                          XEvent         *event);
 static guint32 event_get_time           (MetaDisplay    *display,
@@ -417,6 +419,10 @@ meta_display_open (void)
   the_display->grab_op = META_GRAB_OP_NONE;
   the_display->grab_wireframe_active = FALSE;
   the_display->grab_window = NULL;
+  the_display->grab_has_pending_motion = FALSE;
+  the_display->grab_pending_motion_idle = 0;
+  the_display->grab_motion_events = 0;
+  the_display->grab_collapsed_motion_events = 0;
   the_display->grab_screen = NULL;
   the_display->grab_resize_popup = NULL;
   the_display->grab_tile_mode = META_TILE_NONE;
@@ -713,73 +719,18 @@ meta_display_open (void)
   return TRUE;
 }
 
-static void
-listify_func (gpointer key, gpointer value, gpointer data)
-{
-  GSList **listp;
-
-  listp = data;
-  *listp = g_slist_prepend (*listp, value);
-}
-
-static gint
-ptrcmp (gconstpointer a, gconstpointer b)
-{
-  if (a < b)
-    return -1;
-  else if (a > b)
-    return 1;
-  else
-    return 0;
-}
-
 GSList*
 meta_display_list_windows (MetaDisplay *display)
 {
   GSList *winlist;
-  GSList *tmp;
-  GSList *prev;
-
-  winlist = NULL;
-  g_hash_table_foreach (display->window_ids,
-                        listify_func,
-                        &winlist);
-
-  /* Uniquify the list, since both frame windows and plain
-   * windows are in the hash
-   */
-  winlist = g_slist_sort (winlist, ptrcmp);
-
-  prev = NULL;
-  tmp = winlist;
-  while (tmp != NULL)
-    {
-      GSList *next;
-
-      next = tmp->next;
-
-      if (next &&
-          next->data == tmp->data)
-        {
-          /* Delete tmp from list */
-
-          if (prev)
-            prev->next = next;
-
-          if (tmp == winlist)
-            winlist = next;
-
-          g_slist_free_1 (tmp);
+  GList *tmp;
 
-          /* leave prev unchanged */
-        }
-      else
-        {
-          prev = tmp;
-        }
+  if (display->screen == NULL)
+    return NULL;
 
-      tmp = next;
-    }
+  winlist = NULL;
+  for (tmp = display->screen->managed_windows.tail; tmp != NULL; tmp = tmp->prev)
+    winlist = g_slist_prepend (winlist, tmp->data);
 
   return winlist;
 }
@@ -813,6 +764,9 @@ meta_display_close (MetaDisplay *display,
                              event_callback,
                              display);
 
+  if (display->grab_pending_motion_idle != 0)
+    g_source_remove (display->grab_pending_motion_idle);
+
   if (display->screen != NULL)
     {
       meta_screen_free (display->screen, timestamp);
@@ -1452,25 +1406,21 @@ button_press_event_new (XEvent *xevent)
  * busy around here. Most of this function is a ginormous switch statement
  * dealing with all the kinds of events that might turn up.
  *
- * \param event The event that just happened
- * \param data  The MetaDisplay that events are coming from, cast to a gpointer
- *              so that it can be sent to a callback
+ * \param display The MetaDisplay that events are coming from
+ * \param event   The event that just happened
  *
  * \ingroup main
  */
 static gboolean
-event_callback (XEvent   *event,
-                gpointer  data)
+handle_event (MetaDisplay *display,
+              XEvent      *event)
 {
   MetaWindow *window;
   MetaWindow *property_for_window;
-  MetaDisplay *display;
   Window modified;
   gboolean frame_was_receiver;
   gboolean filter_out_event;
 
-  display = data;
-
 #ifdef WITH_VERBOSE_MODE
   if (dump_events)
     meta_spew_event (display, event);
@@ -2445,6 +2395,117 @@ event_callback (XEvent   *event,
   return filter_out_event;
 }
 
+static gboolean
+is_grab_motion (MetaDisplay *display,
+                XEvent      *event)
+{
+  return event->type == MotionNotify &&
+         event->xmotion.window == display->grab_xwindow &&
+         grab_op_is_mouse (display->grab_op) &&
+         (meta_grab_op_is_moving (display->grab_op) ||
+          meta_grab_op_is_resizing (display->grab_op));
+}
+
+static void
+drop_pending_motion (MetaDisplay *display)
+{
+  display->grab_has_pending_motion = FALSE;
+
+  if (display->grab_pending_motion_idle != 0)
+    {
+      g_source_remove (display->grab_pending_motion_idle);
+      display->grab_pending_motion_idle = 0;
+    }
+}
+
+static void
+flush_pending_motion (MetaDisplay *display)
+{
+  XEvent event;
+
+  if (!display->grab_has_pending_motion)
+    return;
+
+  event = display->grab_pending_motion;
+  drop_pending_motion (display);
+
+  handle_event (display, &event);
+}
+
+static gboolean
+flush_pending_motion_idle (gpointer data)
+{
+  MetaDisplay *display;
+
+  display = data;
+  display->grab_pending_motion_idle = 0;
+
+  /* The events we were waiting for were taken off the queue
+   * without coming through event_callback()
+   */
+  flush_pending_motion (display);
+
+  return FALSE;
+}
+
+/**
+ * Passes events to handle_event(), collapsing the motion events of a
+ * move or resize grab.  While more events are already queued, the
+ * latest motion event is only kept, replacing any kept before it; it
+ * is handled when the queue runs dry, or before the next event which
+ * isn't grab motion.  Unlike searching the queue for later motion
+ * events, this costs the same however deep the queue is.
+ *
+ * \param event The event that just happened
+ * \param data  The MetaDisplay that events are coming from, cast to a gpointer
+ *              so that it can be sent to a callback
+ */
+static gboolean
+event_callback (XEvent   *event,
+                gpointer  data)
+{
+  MetaDisplay *display;
+
+  display = data;
+
+  /* Property changes are reloaded in batches; make sure the ones
+   * already seen are in effect before anything else happens
+   */
+  if (event->type != PropertyNotify)
+    meta_display_reload_pending_properties (display);
+
+  if (is_grab_motion (display, event))
+    {
+      display->grab_motion_events += 1;
+
+      if (display->grab_has_pending_motion)
+        display->grab_collapsed_motion_events += 1;
+
+      if (XQLength (display->xdisplay) > 0)
+        {
+          display->grab_pending_motion = *event;
+          display->grab_has_pending_motion = TRUE;
+
+          if (display->grab_pending_motion_idle == 0)
+            display->grab_pending_motion_idle =
+              g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                               flush_pending_motion_idle,
+                               display, NULL);
+
+          return TRUE;
+        }
+
+      /* This is the latest motion there is */
+      drop_pending_motion (display);
+    }
+  else
+    {
+      flush_pending_motion (display);
+    }
+
+  return handle_event (display, event);
+}
+
 /* Return the window this has to do with, if any, rather
  * than the frame or root window that was selecting
  * for substructure
@@ -3394,7 +3455,8 @@ meta_display_begin_grab_op (MetaDisplay *display,
   display->grab_latest_motion_y = root_y;
   display->grab_last_moveresize_time.tv_sec = 0;
   display->grab_last_moveresize_time.tv_usec = 0;
-  display->grab_motion_notify_time = 0;
+  display->grab_motion_events = 0;
+  display->grab_collapsed_motion_events = 0;
   display->grab_old_window_stacking = NULL;
   display->grab_sync_request_alarm = None;
   display->grab_last_user_action_was_snap = FALSE;
@@ -3601,6 +3663,19 @@ meta_display_end_grab_op (MetaDisplay *display,
   if (display->grab_op == META_GRAB_OP_NONE)
     return;
 
+  /* A motion still waiting belongs to the grab we're ending */
+  if (display->grab_has_pending_motion)
+    {
+      display->grab_collapsed_motion_events += 1;
+      drop_pending_motion (display);
+    }
+
+  if (display->grab_motion_events > 0)
+    meta_topic (META_DEBUG_RESIZING,
+                "Grab op %u collapsed %u of %u motion events\n",
+                display->grab_op, display->grab_collapsed_motion_events,
+                display->grab_motion_events);
+
   if (display->grab_window != NULL)
     display->grab_window->shaken_loose = FALSE;
 
@@ -199,6 +199,13 @@ meta_window_group_leader_changed (MetaWindow *window)
 {
   remove_window_from_group (window);
   meta_window_compute_group (window);
+
+  /* The stacking constraints of both the old and the new group have
+   * changed. A window that is still being constructed isn't in the
+   * stack yet.
+   */
+  if (!window->constructing)
+    meta_window_update_layer (window);
 }
 
 void
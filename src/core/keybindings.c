@@ -104,6 +104,14 @@ static GHashTable *key_handlers;
 
 #define HANDLER(name) g_hash_table_lookup (key_handlers, (name))
 
+/* Key of a binding in the dispatch tables; the mask is only ever
+ * compared against the low byte of an event's state
+ */
+#define DISPATCH_KEY(keycode, mask) \
+  GUINT_TO_POINTER (((keycode) << 8) | ((mask) & 0xff))
+
+#define DISPATCH_BENCHMARK_ROUNDS 1000
+
 static void
 key_handler_free (MetaKeyHandler *handler)
 {
@@ -302,6 +310,128 @@ reload_keycodes (MetaDisplay *display)
     }
 }
 
+static gboolean
+binding_is_per_window (MetaKeyBinding *binding)
+{
+  return binding->handler != NULL &&
+         (binding->handler->flags & META_KEY_BINDING_PER_WINDOW) != 0;
+}
+
+/* The lookup the dispatch tables replace, kept to compare against */
+static MetaKeyBinding *
+find_binding_linear (MetaDisplay  *display,
+                     unsigned int  keycode,
+                     unsigned int  mask,
+                     gboolean      on_window)
+{
+  int i;
+
+  for (i = 0; i < display->n_key_bindings; i++)
+    {
+      MetaKeyBinding *binding = &display->key_bindings[i];
+
+      if ((!on_window && binding_is_per_window (binding)) ||
+          binding->keycode != keycode ||
+          binding->mask != mask)
+        continue;
+
+      return binding;
+    }
+
+  return NULL;
+}
+
+/* Times looking up every binding in the dispatch tables against
+ * scanning the binding array, as process_event() used to.
+ */
+static void
+benchmark_dispatch_tables (MetaDisplay *display)
+{
+  GTimer *timer;
+  gdouble linear_time;
+  gdouble hashed_time;
+  guint n_lookups;
+  int round;
+  int i;
+
+  if (display->n_key_bindings == 0)
+    return;
+
+  timer = g_timer_new ();
+  n_lookups = 0;
+
+  for (round = 0; round < DISPATCH_BENCHMARK_ROUNDS; round++)
+    for (i = 0; i < display->n_key_bindings; i++)
+      {
+        MetaKeyBinding *binding = &display->key_bindings[i];
+
+        if (find_binding_linear (display, binding->keycode,
+                                 binding->mask, TRUE) != NULL)
+          n_lookups += 1;
+      }
+
+  linear_time = g_timer_elapsed (timer, NULL);
+  g_timer_start (timer);
+
+  for (round = 0; round < DISPATCH_BENCHMARK_ROUNDS; round++)
+    for (i = 0; i < display->n_key_bindings; i++)
+      {
+        MetaKeyBinding *binding = &display->key_bindings[i];
+        gpointer key;
+
+        key = DISPATCH_KEY (binding->keycode, binding->mask);
+        if (g_hash_table_lookup (display->window_key_dispatch, key) != NULL)
+          n_lookups += 1;
+      }
+
+  hashed_time = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              "Binding lookup over %d bindings (%u found): "
+              "%.1f ns scanning, %.1f ns hashed\n",
+              display->n_key_bindings, n_lookups,
+              linear_time * 1e9 / (DISPATCH_BENCHMARK_ROUNDS * display->n_key_bindings),
+              hashed_time * 1e9 / (DISPATCH_BENCHMARK_ROUNDS * display->n_key_bindings));
+}
+
+static void
+rebuild_dispatch_tables (MetaDisplay *display)
+{
+  int i;
+
+  g_hash_table_remove_all (display->window_key_dispatch);
+  g_hash_table_remove_all (display->screen_key_dispatch);
+
+  for (i = 0; i < display->n_key_bindings; i++)
+    {
+      MetaKeyBinding *binding = &display->key_bindings[i];
+      gpointer key;
+
+      /* Bindings which can't match any key press */
+      if (binding->keycode == 0 || (binding->mask & ~0xff) != 0)
+        continue;
+
+      key = DISPATCH_KEY (binding->keycode, binding->mask);
+
+      /* Keep the first binding for a key, which the scan used to find */
+      if (!g_hash_table_contains (display->window_key_dispatch, key))
+        g_hash_table_insert (display->window_key_dispatch, key, binding);
+
+      if (!binding_is_per_window (binding) &&
+          !g_hash_table_contains (display->screen_key_dispatch, key))
+        g_hash_table_insert (display->screen_key_dispatch, key, binding);
+    }
+
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              " %u window and %u screen keys in dispatch tables\n",
+              g_hash_table_size (display->window_key_dispatch),
+              g_hash_table_size (display->screen_key_dispatch));
+
+  if (g_getenv ("METACITY_BENCHMARK_KEYBINDINGS"))
+    benchmark_dispatch_tables (display);
+}
+
 static void
 reload_modifiers (MetaDisplay *display)
 {
@@ -332,6 +462,9 @@ reload_modifiers (MetaDisplay *display)
           ++i;
         }
     }
+
+  /* Keycodes and masks are final now */
+  rebuild_dispatch_tables (display);
 }
 
 static int
@@ -378,6 +511,12 @@ rebuild_binding_table (MetaDisplay     *display,
   int n_bindings;
   int i;
 
+  /* The dispatch tables point into the old table; they are filled
+   * again once keycodes and modifiers have been resolved
+   */
+  g_hash_table_remove_all (display->window_key_dispatch);
+  g_hash_table_remove_all (display->screen_key_dispatch);
+
   n_bindings = count_bindings (prefs);
   g_free (*bindings_p);
   *bindings_p = g_new0 (MetaKeyBinding, n_bindings);
@@ -618,6 +757,9 @@ meta_display_shutdown_keys (MetaDisplay *display)
   if (display->modmap)
     XFreeModifiermap (display->modmap);
   g_free (display->key_bindings);
+
+  g_hash_table_destroy (display->window_key_dispatch);
+  g_hash_table_destroy (display->screen_key_dispatch);
 }
 
 /* Grab/ungrab, ignoring all annoying modifiers like NumLock etc. */
@@ -1165,71 +1307,70 @@ primary_modifier_still_pressed (MetaDisplay *display,
 
 /* now called from only one place, may be worth merging */
 static gboolean
-process_event (MetaKeyBinding       *bindings,
-               int                   n_bindings,
-               MetaDisplay          *display,
+process_event (MetaDisplay          *display,
                MetaScreen           *screen,
                MetaWindow           *window,
                XEvent               *event,
                KeySym                keysym,
                gboolean              on_window)
 {
-  int i;
+  GHashTable *dispatch;
+  MetaKeyBinding *binding;
+  const MetaKeyHandler *handler;
+  unsigned int mask;
 
   /* we used to have release-based bindings but no longer. */
-  if (event->type == KeyRelease)
+  if (event->type != KeyPress)
     return FALSE;
 
-  /*
-   * TODO: This would be better done with a hash table;
-   * it doesn't suit to use O(n) for such a common operation.
-   */
-  for (i=0; i<n_bindings; i++)
-    {
-      const MetaKeyHandler *handler = bindings[i].handler;
+  dispatch = on_window ? display->window_key_dispatch :
+                         display->screen_key_dispatch;
 
-      if ((!on_window && handler->flags & META_KEY_BINDING_PER_WINDOW) ||
-          event->type != KeyPress ||
-          bindings[i].keycode != event->xkey.keycode ||
-          ((event->xkey.state & 0xff & ~(display->ignored_modifier_mask)) !=
-           bindings[i].mask))
-        continue;
-
-      /*
-       * window must be non-NULL for on_window to be true,
-       * and so also window must be non-NULL if we get here and
-       * this is a META_KEY_BINDING_PER_WINDOW binding.
-       */
+  mask = event->xkey.state & 0xff & ~(display->ignored_modifier_mask);
+  binding = g_hash_table_lookup (dispatch,
+                                 DISPATCH_KEY (event->xkey.keycode, mask));
 
+  if (binding == NULL)
+    {
       meta_topic (META_DEBUG_KEYBINDINGS,
-                  "Binding keycode 0x%x mask 0x%x matches event 0x%x state 0x%x\n",
-                  bindings[i].keycode, bindings[i].mask,
-                  event->xkey.keycode, event->xkey.state);
+                  "No handler found for this event in this binding table\n");
+      return FALSE;
+    }
 
-      if (handler == NULL)
-        meta_bug ("Binding %s has no handler\n", bindings[i].name);
-      else
-        meta_topic (META_DEBUG_KEYBINDINGS,
-                    "Running handler for %s\n",
-                    bindings[i].name);
+  /*
+   * window must be non-NULL for on_window to be true,
+   * and so also window must be non-NULL if we get here and
+   * this is a META_KEY_BINDING_PER_WINDOW binding.
+   */
 
-      /* Global keybindings count as a let-the-terminal-lose-focus
-       * due to new window mapping until the user starts
-       * interacting with the terminal again.
-       */
-      display->allow_terminal_deactivation = TRUE;
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              "Binding keycode 0x%x mask 0x%x matches event 0x%x state 0x%x\n",
+              binding->keycode, binding->mask,
+              event->xkey.keycode, event->xkey.state);
 
-      (* handler->func) (display, screen,
-                         bindings[i].handler->flags & META_KEY_BINDING_PER_WINDOW ? window: NULL,
-                         event,
-                         &bindings[i],
-                         NULL);
-      return TRUE;
+  handler = binding->handler;
+  if (handler == NULL)
+    {
+      meta_bug ("Binding %s has no handler\n", binding->name);
+      return FALSE;
     }
 
   meta_topic (META_DEBUG_KEYBINDINGS,
-              "No handler found for this event in this binding table\n");
-  return FALSE;
+              "Running handler for %s\n",
+              binding->name);
+
+  /* Global keybindings count as a let-the-terminal-lose-focus
+   * due to new window mapping until the user starts
+   * interacting with the terminal again.
+   */
+  display->allow_terminal_deactivation = TRUE;
+
+  (* handler->func) (display, screen,
+                     handler->flags & META_KEY_BINDING_PER_WINDOW ? window: NULL,
+                     event,
+                     binding,
+                     NULL);
+  return TRUE;
 }
 
 /* Handle a key event. May be called recursively: some key events cause
@@ -1385,9 +1526,7 @@ meta_display_process_key_event (MetaDisplay *display,
         }
       }
   /* Do the normal keybindings */
-  process_event (display->key_bindings,
-                 display->n_key_bindings,
-                 display, screen, window, event, keysym,
+  process_event (display, screen, window, event, keysym,
                  !all_keys_grabbed && window);
 }
 
@@ -3968,6 +4107,8 @@ meta_display_init_keys (MetaDisplay *display)
   display->meta_mask = 0;
   display->key_bindings = NULL;
   display->n_key_bindings = 0;
+  display->window_key_dispatch = g_hash_table_new (NULL, NULL);
+  display->screen_key_dispatch = g_hash_table_new (NULL, NULL);
 
   XDisplayKeycodes (display->xdisplay,
                     &display->min_keycode,
@@ -47,6 +47,18 @@ struct _MetaXineramaScreenInfo
 typedef void (* MetaScreenWindowFunc) (MetaScreen *screen, MetaWindow *window,
                                        gpointer user_data);
 
+typedef struct _MetaScreenWindowIter MetaScreenWindowIter;
+
+/* A walk over the managed windows of a screen in progress.  The screen
+ * keeps a chain of these so that removing a window can step any walk
+ * that was about to visit it.
+ */
+struct _MetaScreenWindowIter
+{
+  GList *next;
+  MetaScreenWindowIter *outer;
+};
+
 typedef enum
 {
   META_SCREEN_TOPLEFT,
@@ -117,6 +129,14 @@ struct _MetaScreen
 
   guint work_area_idle;
 
+  /* The managed windows, in the order they were managed.  Each
+   * element is the screen_link of the MetaWindow itself.
+   */
+  GQueue managed_windows;
+
+  /* Innermost meta_screen_foreach_window() in progress, or NULL */
+  MetaScreenWindowIter *window_iters;
+
   int rows_of_workspaces;
   int columns_of_workspaces;
   MetaScreenCorner starting_corner;
@@ -140,6 +160,10 @@ MetaScreen*   meta_screen_new                 (MetaDisplay                *displ
 void          meta_screen_free                (MetaScreen                 *screen,
                                                guint32                     timestamp);
 void          meta_screen_manage_all_windows  (MetaScreen                 *screen);
+void          meta_screen_add_window          (MetaScreen                 *screen,
+                                               MetaWindow                 *window);
+void          meta_screen_remove_window       (MetaScreen                 *screen,
+                                               MetaWindow                 *window);
 void          meta_screen_foreach_window      (MetaScreen                 *screen,
                                                MetaScreenWindowFunc        func,
                                                gpointer                    data);
@@ -46,7 +46,10 @@
 #endif
 
 #include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/shape.h>
 #include <locale.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -495,6 +498,9 @@ meta_screen_new (MetaDisplay *display,
 
   screen->work_area_idle = 0;
 
+  g_queue_init (&screen->managed_windows);
+  screen->window_iters = NULL;
+
   screen->active_workspace = NULL;
   screen->workspaces = NULL;
   screen->rows_of_workspaces = 1;
@@ -711,46 +717,214 @@ meta_screen_free (MetaScreen *screen,
 
 typedef struct
 {
-  Window		xwindow;
-  XWindowAttributes	attrs;
+  Window             xwindow;
+  MetaWindowPrefetch prefetch;
 } WindowInfo;
 
+typedef struct
+{
+  xcb_get_window_attributes_cookie_t attrs;
+  xcb_get_geometry_cookie_t geometry;
+  xcb_shape_query_extents_cookie_t shape;
+  xcb_get_property_cookie_t wm_state;
+} WindowCookies;
+
+static Visual *
+find_visual (Screen         *xscreen,
+             xcb_visualid_t  visualid)
+{
+  int i, j;
+
+  for (i = 0; i < xscreen->ndepths; i++)
+    {
+      Depth *depth = &xscreen->depths[i];
+
+      for (j = 0; j < depth->nvisuals; j++)
+        if (depth->visuals[j].visualid == visualid)
+          return &depth->visuals[j];
+    }
+
+  return NULL;
+}
+
+static void
+fill_window_attributes (MetaScreen                        *screen,
+                        XWindowAttributes                 *attrs,
+                        xcb_get_window_attributes_reply_t *attrs_reply,
+                        xcb_get_geometry_reply_t          *geometry_reply)
+{
+  Screen *xscreen;
+
+  xscreen = ScreenOfDisplay (screen->display->xdisplay, screen->number);
+
+  attrs->x = geometry_reply->x;
+  attrs->y = geometry_reply->y;
+  attrs->width = geometry_reply->width;
+  attrs->height = geometry_reply->height;
+  attrs->border_width = geometry_reply->border_width;
+  attrs->depth = geometry_reply->depth;
+  attrs->visual = find_visual (xscreen, attrs_reply->visual);
+  attrs->root = geometry_reply->root;
+  attrs->class = attrs_reply->_class;
+  attrs->bit_gravity = attrs_reply->bit_gravity;
+  attrs->win_gravity = attrs_reply->win_gravity;
+  attrs->backing_store = attrs_reply->backing_store;
+  attrs->backing_planes = attrs_reply->backing_planes;
+  attrs->backing_pixel = attrs_reply->backing_pixel;
+  attrs->save_under = attrs_reply->save_under;
+  attrs->colormap = attrs_reply->colormap;
+  attrs->map_installed = attrs_reply->map_is_installed;
+  attrs->map_state = attrs_reply->map_state;
+  attrs->all_event_masks = attrs_reply->all_event_masks;
+  attrs->your_event_mask = attrs_reply->your_event_mask;
+  attrs->do_not_propagate_mask = attrs_reply->do_not_propagate_mask;
+  attrs->override_redirect = attrs_reply->override_redirect;
+  attrs->screen = xscreen;
+}
+
+/**
+ * Lists the children of the root window with their attributes.  If
+ * @prefetch_state is set, their shape and WM_STATE are fetched too.
+ *
+ * All the requests are sent before any reply is waited for, so the
+ * whole list costs a single round trip however many windows there are.
+ * Windows which are destroyed meanwhile are left out.
+ */
 static GList *
-list_windows (MetaScreen *screen)
+list_windows (MetaScreen *screen,
+              gboolean    prefetch_state)
 {
+  MetaDisplay *display;
+  xcb_connection_t *xcb_conn;
   Window ignored1, ignored2;
   Window *children;
   guint n_children, i;
+  WindowCookies *cookies;
   GList *result;
+  gint64 start_time;
+  gint64 sent_time;
+
+  display = screen->display;
+  xcb_conn = XGetXCBConnection (display->xdisplay);
 
-  XQueryTree (screen->display->xdisplay,
+  XQueryTree (display->xdisplay,
               screen->xroot,
               &ignored1, &ignored2, &children, &n_children);
 
-  result = NULL;
+  start_time = g_get_monotonic_time ();
+
+  cookies = g_new0 (WindowCookies, n_children);
   for (i = 0; i < n_children; ++i)
     {
-      WindowInfo *info = g_new0 (WindowInfo, 1);
+      cookies[i].attrs = xcb_get_window_attributes (xcb_conn, children[i]);
+      cookies[i].geometry = xcb_get_geometry (xcb_conn, children[i]);
 
-      meta_error_trap_push (screen->display);
+      if (!prefetch_state)
+        continue;
 
-      XGetWindowAttributes (screen->display->xdisplay,
-                            children[i], &info->attrs);
+      if (META_DISPLAY_HAS_SHAPE (display))
+        cookies[i].shape = xcb_shape_query_extents (xcb_conn, children[i]);
 
-      if (meta_error_trap_pop_with_return (screen->display))
-	{
+      cookies[i].wm_state = xcb_get_property (xcb_conn, FALSE, children[i],
+                                              display->atom_WM_STATE,
+                                              display->atom_WM_STATE,
+                                              0, 1);
+    }
+  xcb_flush (xcb_conn);
+
+  sent_time = g_get_monotonic_time ();
+
+  result = NULL;
+  for (i = 0; i < n_children; ++i)
+    {
+      xcb_get_window_attributes_reply_t *attrs_reply;
+      xcb_get_geometry_reply_t *geometry_reply;
+      xcb_generic_error_t *error;
+      WindowInfo *info;
+
+      /* Every reply has to be collected, even for windows we drop */
+      error = NULL;
+      attrs_reply = xcb_get_window_attributes_reply (xcb_conn,
+                                                     cookies[i].attrs,
+                                                     &error);
+      free (error);
+
+      error = NULL;
+      geometry_reply = xcb_get_geometry_reply (xcb_conn,
+                                               cookies[i].geometry,
+                                               &error);
+      free (error);
+
+      info = NULL;
+      if (attrs_reply != NULL && geometry_reply != NULL)
+        {
+          info = g_new0 (WindowInfo, 1);
+          info->xwindow = children[i];
+
+          fill_window_attributes (screen, &info->prefetch.attrs,
+                                  attrs_reply, geometry_reply);
+        }
+      else
+        {
           meta_verbose ("Failed to get attributes for window 0x%lx\n",
                         children[i]);
-	  g_free (info);
         }
-      else
+
+      free (attrs_reply);
+      free (geometry_reply);
+
+      if (prefetch_state && META_DISPLAY_HAS_SHAPE (display))
         {
-	  info->xwindow = children[i];
-	}
+          xcb_shape_query_extents_reply_t *shape_reply;
+
+          error = NULL;
+          shape_reply = xcb_shape_query_extents_reply (xcb_conn,
+                                                       cookies[i].shape,
+                                                       &error);
+          free (error);
+
+          if (info != NULL && shape_reply != NULL)
+            info->prefetch.has_shape = shape_reply->bounding_shaped != 0;
+
+          free (shape_reply);
+        }
 
-      result = g_list_prepend (result, info);
+      if (prefetch_state)
+        {
+          xcb_get_property_reply_t *wm_state_reply;
+
+          error = NULL;
+          wm_state_reply = xcb_get_property_reply (xcb_conn,
+                                                   cookies[i].wm_state,
+                                                   &error);
+          free (error);
+
+          /* WM_STATE isn't a cardinal, it's type WM_STATE, but is an int */
+          if (info != NULL && wm_state_reply != NULL &&
+              wm_state_reply->type == display->atom_WM_STATE &&
+              wm_state_reply->format == 32 &&
+              xcb_get_property_value_length (wm_state_reply) >= 4)
+            {
+              info->prefetch.has_wm_state = TRUE;
+              info->prefetch.wm_state =
+                *(guint32 *) xcb_get_property_value (wm_state_reply);
+            }
+
+          free (wm_state_reply);
+        }
+
+      if (info != NULL)
+        result = g_list_prepend (result, info);
     }
 
+  meta_topic (META_DEBUG_STARTUP,
+              "Fetched %u root window children in %" G_GINT64_FORMAT " us "
+              "(%" G_GINT64_FORMAT " us sending requests)\n",
+              n_children, g_get_monotonic_time () - start_time,
+              sent_time - start_time);
+
+  g_free (cookies);
+
   if (children)
     XFree (children);
 
@@ -762,10 +936,21 @@ meta_screen_manage_all_windows (MetaScreen *screen)
 {
   GList *windows;
   GList *list;
+  gint64 start_time;
+  gint64 listed_time;
+  gint64 end_time;
+  guint n_windows;
+  guint n_managed;
+
+  start_time = g_get_monotonic_time ();
 
   meta_display_grab (screen->display);
 
-  windows = list_windows (screen);
+  windows = list_windows (screen, TRUE);
+
+  listed_time = g_get_monotonic_time ();
+  n_windows = 0;
+  n_managed = 0;
 
   meta_stack_freeze (screen->stack);
   for (list = windows; list != NULL; list = list->next)
@@ -773,8 +958,12 @@ meta_screen_manage_all_windows (MetaScreen *screen)
       WindowInfo *info = list->data;
       MetaWindow *window;
 
-      window = meta_window_new_with_attrs (screen->display, info->xwindow, TRUE,
-                                           &info->attrs);
+      window = meta_window_new_prefetched (screen->display, info->xwindow,
+                                           TRUE, &info->prefetch);
+      n_windows += 1;
+      if (window != NULL)
+        n_managed += 1;
+
       if (info->xwindow == screen->no_focus_window ||
           info->xwindow == screen->flash_window ||
           info->xwindow == screen->wm_cm_selection_window ||
@@ -784,7 +973,7 @@ meta_screen_manage_all_windows (MetaScreen *screen)
       }
 
       meta_compositor_add_window (screen->display->compositor, window,
-                                  info->xwindow, &info->attrs);
+                                  info->xwindow, &info->prefetch.attrs);
     }
   meta_stack_thaw (screen->stack);
 
@@ -792,6 +981,17 @@ meta_screen_manage_all_windows (MetaScreen *screen)
   g_list_free (windows);
 
   meta_display_ungrab (screen->display);
+
+  end_time = g_get_monotonic_time ();
+
+  meta_topic (META_DEBUG_STARTUP,
+              "Managed %u of %u windows in %" G_GINT64_FORMAT " us: "
+              "%" G_GINT64_FORMAT " us listing, %" G_GINT64_FORMAT " us "
+              "managing\n",
+              n_managed, n_windows,
+              end_time - start_time,
+              listed_time - start_time,
+              end_time - listed_time);
 }
 
 void
@@ -802,7 +1002,7 @@ meta_screen_composite_all_windows (MetaScreen *screen)
 
   display = screen->display;
 
-  windows = list_windows (screen);
+  windows = list_windows (screen, FALSE);
 
   meta_stack_freeze (screen->stack);
 
@@ -821,7 +1021,7 @@ meta_screen_composite_all_windows (MetaScreen *screen)
 
       window = meta_display_lookup_x_window (display, info->xwindow);
       meta_compositor_add_window (display->compositor, window,
-                                  info->xwindow, &info->attrs);
+                                  info->xwindow, &info->prefetch.attrs);
     }
 
   meta_stack_thaw (screen->stack);
@@ -899,64 +1099,60 @@ get_screen_name (MetaDisplay *display,
   return scr;
 }
 
-static gint
-ptrcmp (gconstpointer a, gconstpointer b)
+void
+meta_screen_add_window (MetaScreen *screen,
+                        MetaWindow *window)
 {
-  if (a < b)
-    return -1;
-  else if (a > b)
-    return 1;
-  else
-    return 0;
+  window->screen_link.data = window;
+  window->screen_link.prev = NULL;
+  window->screen_link.next = NULL;
+
+  g_queue_push_tail_link (&screen->managed_windows, &window->screen_link);
 }
 
-static void
-listify_func (gpointer key, gpointer value, gpointer data)
+void
+meta_screen_remove_window (MetaScreen *screen,
+                           MetaWindow *window)
 {
-  GSList **listp;
+  MetaScreenWindowIter *iter;
 
-  listp = data;
+  /* Don't let a walk in progress step onto the window we're removing */
+  for (iter = screen->window_iters; iter != NULL; iter = iter->outer)
+    {
+      if (iter->next == &window->screen_link)
+        iter->next = window->screen_link.next;
+    }
 
-  *listp = g_slist_prepend (*listp, value);
+  g_queue_unlink (&screen->managed_windows, &window->screen_link);
 }
 
+/**
+ * Calls @func on each window managed on @screen.  @func may manage
+ * and unmanage windows, including the ones not visited yet; windows
+ * managed during the walk may or may not be visited.
+ */
 void
 meta_screen_foreach_window (MetaScreen *screen,
                             MetaScreenWindowFunc func,
                             gpointer data)
 {
-  GSList *winlist;
-  GSList *tmp;
-
-  /* If we end up doing this often, just keeping a list
-   * of windows might be sensible.
-   */
-
-  winlist = NULL;
-  g_hash_table_foreach (screen->display->window_ids,
-                        listify_func,
-                        &winlist);
+  MetaScreenWindowIter iter;
+  GList *link;
 
-  winlist = g_slist_sort (winlist, ptrcmp);
+  iter.outer = screen->window_iters;
+  screen->window_iters = &iter;
 
-  tmp = winlist;
-  while (tmp != NULL)
+  link = screen->managed_windows.head;
+  while (link != NULL)
     {
-      /* If the next node doesn't contain this window
-       * a second time, delete the window.
-       */
-      if (tmp->next == NULL ||
-          (tmp->next && tmp->next->data != tmp->data))
-        {
-          MetaWindow *window = tmp->data;
+      iter.next = link->next;
 
-          if (window->screen == screen)
-            (* func) (screen, window, data);
-        }
+      (* func) (screen, link->data, data);
 
-      tmp = tmp->next;
+      link = iter.next;
     }
-  g_slist_free (winlist);
+
+  screen->window_iters = iter.outer;
 }
 
 static void
@@ -2860,6 +3056,22 @@ meta_screen_get_size (MetaScreen *screen,
   *height = screen->rect.height;
 }
 
+int
+meta_screen_get_n_xineramas (MetaScreen *screen)
+{
+  return screen->n_xinerama_infos;
+}
+
+void
+meta_screen_get_xinerama_geometry (MetaScreen    *screen,
+                                   int            xinerama,
+                                   MetaRectangle *geometry)
+{
+  g_return_if_fail (xinerama >= 0 && xinerama < screen->n_xinerama_infos);
+
+  *geometry = screen->xinerama_infos[xinerama].rect;
+}
+
 gpointer
 meta_screen_get_compositor_data (MetaScreen *screen)
 {
@@ -34,6 +34,7 @@
 #include "workspace.h"
 
 #include <X11/Xatom.h>
+#include <string.h>
 
 #define WINDOW_HAS_TRANSIENT_TYPE(w)                    \
           (w->type == META_WINDOW_DIALOG ||             \
@@ -59,6 +60,7 @@ static void stack_do_constrain        (MetaStack *stack);
 static void stack_do_resort           (MetaStack *stack);
 
 static void stack_ensure_sorted (MetaStack *stack);
+static void free_constraints    (MetaStack *stack);
 
 MetaStack*
 meta_stack_new (MetaScreen *screen)
@@ -79,9 +81,23 @@ meta_stack_new (MetaScreen *screen)
 
   stack->n_positions = 0;
 
+  stack->unsorted = NULL;
+  stack->moved = NULL;
+  stack->constraints = NULL;
+  stack->window_constraints = NULL;
+
   stack->need_resort = FALSE;
   stack->need_relayer = FALSE;
   stack->need_constrain = FALSE;
+  stack->need_constraint_graph = TRUE;
+  stack->applying_constraints = FALSE;
+
+  stack->publish_client_lists_id = 0;
+  stack->last_client_list = NULL;
+  stack->last_client_list_stacking = NULL;
+  stack->n_client_list_publishes = 0;
+  stack->n_coalesced_publishes = 0;
+  stack->n_unchanged_properties = 0;
 
   return stack;
 }
@@ -94,10 +110,22 @@ meta_stack_free (MetaStack *stack)
   g_list_free (stack->sorted);
   g_list_free (stack->added);
   g_list_free (stack->removed);
+  g_list_free (stack->unsorted);
+  g_list_free (stack->moved);
+
+  free_constraints (stack);
 
   if (stack->last_root_children_stacked)
     g_array_free (stack->last_root_children_stacked, TRUE);
 
+  if (stack->publish_client_lists_id != 0)
+    g_source_remove (stack->publish_client_lists_id);
+
+  if (stack->last_client_list)
+    g_array_free (stack->last_client_list, TRUE);
+  if (stack->last_client_list_stacking)
+    g_array_free (stack->last_client_list_stacking, TRUE);
+
   g_free (stack);
 }
 
@@ -143,6 +171,13 @@ meta_stack_remove (MetaStack  *stack,
   stack->added = g_list_remove (stack->added, window);
   stack->sorted = g_list_remove (stack->sorted, window);
 
+  stack->unsorted = g_list_remove (stack->unsorted, window);
+  stack->moved = g_list_remove (stack->moved, window);
+
+  /* The constraint graph may point to the window */
+  free_constraints (stack);
+  stack->need_constraint_graph = TRUE;
+
   /* Remember the window ID to remove it from the stack array.
    * The macro is safe to use: Window is guaranteed to be 32 bits, and
    * GUINT_TO_POINTER says it only works on 32 bits.
@@ -160,7 +195,11 @@ void
 meta_stack_update_layer (MetaStack  *stack,
                          MetaWindow *window)
 {
+  /* Window type and group changes come through here too, and both
+   * affect the stacking constraints.
+   */
   stack->need_relayer = TRUE;
+  stack->need_constraint_graph = TRUE;
 
   stack_sync_to_server (stack);
 }
@@ -169,7 +208,7 @@ void
 meta_stack_update_transient (MetaStack  *stack,
                              MetaWindow *window)
 {
-  stack->need_constrain = TRUE;
+  stack->need_constraint_graph = TRUE;
 
   stack_sync_to_server (stack);
 }
@@ -443,21 +482,20 @@ struct Constraint
   unsigned int has_prev : 1;
 };
 
-/* We index the array of constraints by window
- * stack positions, just because the stack
- * positions are a convenient index.
+/* While the graph is built, the constraints are kept
+ * in lists indexed by their "below" window.
  */
 static void
-add_constraint (Constraint **constraints,
-                MetaWindow  *above,
-                MetaWindow  *below)
+add_constraint (GHashTable *constraints,
+                MetaWindow *above,
+                MetaWindow *below)
 {
   Constraint *c;
 
   g_assert (above->screen == below->screen);
 
   /* check if constraint is a duplicate */
-  c = constraints[below->stack_position];
+  c = g_hash_table_lookup (constraints, below);
   while (c != NULL)
     {
       if (c->above == above)
@@ -469,17 +507,17 @@ add_constraint (Constraint **constraints,
   c = g_new (Constraint, 1);
   c->above = above;
   c->below = below;
-  c->next = constraints[below->stack_position];
+  c->next = g_hash_table_lookup (constraints, below);
   c->next_nodes = NULL;
   c->applied = FALSE;
   c->has_prev = FALSE;
 
-  constraints[below->stack_position] = c;
+  g_hash_table_insert (constraints, below, c);
 }
 
 static void
-create_constraints (Constraint **constraints,
-                    GList       *windows)
+create_constraints (GHashTable *constraints,
+                    GList      *windows)
 {
   GList *tmp;
 
@@ -565,13 +603,13 @@ create_constraints (Constraint **constraints,
 }
 
 static void
-graph_constraints (Constraint **constraints,
-                   int          n_constraints)
+graph_constraints (GHashTable *constraints)
 {
-  int i;
+  GHashTableIter iter;
+  gpointer value;
 
-  i = 0;
-  while (i < n_constraints)
+  g_hash_table_iter_init (&iter, constraints);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
     {
       Constraint *c;
 
@@ -579,17 +617,15 @@ graph_constraints (Constraint **constraints,
        * add BC to next_nodes in AB.
        */
 
-      c = constraints[i];
+      c = value;
       while (c != NULL)
         {
           Constraint *n;
 
-          g_assert (c->below->stack_position == i);
-
           /* Constraints where ->above is below are our
            * next_nodes and we are their previous
            */
-          n = constraints[c->above->stack_position];
+          n = g_hash_table_lookup (constraints, c->above);
           while (n != NULL)
             {
               c->next_nodes = g_slist_prepend (c->next_nodes,
@@ -602,36 +638,186 @@ graph_constraints (Constraint **constraints,
 
           c = c->next;
         }
+    }
+}
 
-      ++i;
+/* Keeps the constraints in the order of the stack
+ * positions of their "below" windows.
+ */
+static gint
+compare_constraint_position (gconstpointer a,
+                             gconstpointer b)
+{
+  const Constraint *constraint_a = *(Constraint * const *) a;
+  const Constraint *constraint_b = *(Constraint * const *) b;
+
+  if (constraint_a->below->stack_position < constraint_b->below->stack_position)
+    return -1;
+  else if (constraint_a->below->stack_position > constraint_b->below->stack_position)
+    return 1;
+  else
+    return 0;
+}
+
+static void
+free_constraints (MetaStack *stack)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint i;
+
+  if (stack->constraints == NULL)
+    return;
+
+  for (i = 0; i < stack->constraints->len; i++)
+    {
+      Constraint *c = g_ptr_array_index (stack->constraints, i);
+
+      g_slist_free (c->next_nodes);
+      g_free (c);
     }
+
+  g_hash_table_iter_init (&iter, stack->window_constraints);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    g_slist_free (value);
+
+  g_ptr_array_free (stack->constraints, TRUE);
+  g_hash_table_destroy (stack->window_constraints);
+
+  stack->constraints = NULL;
+  stack->window_constraints = NULL;
 }
 
 static void
-free_constraints (Constraint **constraints,
-                  int          n_constraints)
+add_window_constraint (GHashTable *window_constraints,
+                       MetaWindow *window,
+                       Constraint *c)
 {
-  int i;
+  GSList *list;
 
-  i = 0;
-  while (i < n_constraints)
+  list = g_hash_table_lookup (window_constraints, window);
+  g_hash_table_insert (window_constraints, window,
+                       g_slist_prepend (list, c));
+}
+
+/**
+ * Builds the graph of stacking constraints. It is kept until windows,
+ * transiency or layers change, so raising or lowering a window
+ * doesn't need to look at every window again.
+ */
+static void
+build_constraints (MetaStack *stack)
+{
+  GHashTable *by_below;
+  GHashTableIter iter;
+  gpointer value;
+
+  free_constraints (stack);
+
+  by_below = g_hash_table_new (NULL, NULL);
+
+  create_constraints (by_below, stack->sorted);
+
+  graph_constraints (by_below);
+
+  stack->constraints = g_ptr_array_new ();
+  stack->window_constraints = g_hash_table_new (NULL, NULL);
+
+  g_hash_table_iter_init (&iter, by_below);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
     {
       Constraint *c;
 
-      c = constraints[i];
-      while (c != NULL)
+      for (c = value; c != NULL; c = c->next)
         {
-          Constraint *next = c->next;
+          g_ptr_array_add (stack->constraints, c);
 
-          g_slist_free (c->next_nodes);
+          add_window_constraint (stack->window_constraints, c->above, c);
+          add_window_constraint (stack->window_constraints, c->below, c);
+        }
+    }
 
-          g_free (c);
+  g_hash_table_destroy (by_below);
 
-          c = next;
-        }
+  g_ptr_array_sort (stack->constraints, compare_constraint_position);
+}
+
+/**
+ * Finds the constraints that are connected to the given windows, through
+ * any chain of transient windows.
+ */
+static GPtrArray *
+get_connected_constraints (MetaStack *stack,
+                           GList     *windows)
+{
+  GHashTable *seen_windows;
+  GHashTable *seen_constraints;
+  GPtrArray *constraints;
+  GQueue queue;
+  GList *tmp;
+
+  constraints = g_ptr_array_new ();
+
+  if (stack->window_constraints == NULL)
+    return constraints;
+
+  seen_windows = g_hash_table_new (NULL, NULL);
+  seen_constraints = g_hash_table_new (NULL, NULL);
+  g_queue_init (&queue);
+
+  for (tmp = windows; tmp != NULL; tmp = tmp->next)
+    {
+      if (g_hash_table_contains (seen_windows, tmp->data))
+        continue;
+
+      g_hash_table_add (seen_windows, tmp->data);
+      g_queue_push_tail (&queue, tmp->data);
+    }
+
+  while (!g_queue_is_empty (&queue))
+    {
+      MetaWindow *w = g_queue_pop_head (&queue);
+      GSList *link;
+
+      link = g_hash_table_lookup (stack->window_constraints, w);
+      for (; link != NULL; link = link->next)
+        {
+          Constraint *c = link->data;
+
+          if (g_hash_table_contains (seen_constraints, c))
+            continue;
+
+          g_hash_table_add (seen_constraints, c);
+          g_ptr_array_add (constraints, c);
 
-      ++i;
+          if (!g_hash_table_contains (seen_windows, c->above))
+            {
+              g_hash_table_add (seen_windows, c->above);
+              g_queue_push_tail (&queue, c->above);
+            }
+
+          if (!g_hash_table_contains (seen_windows, c->below))
+            {
+              g_hash_table_add (seen_windows, c->below);
+              g_queue_push_tail (&queue, c->below);
+            }
+        }
     }
+
+  g_hash_table_destroy (seen_windows);
+  g_hash_table_destroy (seen_constraints);
+
+  g_ptr_array_sort (constraints, compare_constraint_position);
+
+  return constraints;
+}
+
+static void
+queue_resort_window (MetaStack  *stack,
+                     MetaWindow *window)
+{
+  if (g_list_find (stack->unsorted, window) == NULL)
+    stack->unsorted = g_list_prepend (stack->unsorted, window);
 }
 
 static void
@@ -645,6 +831,7 @@ ensure_above (MetaWindow *above,
 		  "Promoting window %s from layer %u to %u due to contraint\n",
 		  above->desc, above->layer, below->layer);
       above->layer = below->layer;
+      queue_resort_window (above->screen->stack, above);
     }
 
   if (above->stack_position < below->stack_position)
@@ -679,30 +866,22 @@ traverse_constraint (Constraint *c)
 }
 
 static void
-apply_constraints (Constraint **constraints,
-                   int          n_constraints)
+apply_constraints (GPtrArray *constraints)
 {
   GSList *heads;
   GSList *tmp;
-  int i;
+  guint i;
 
   /* List all heads in an ordered constraint chain */
   heads = NULL;
-  i = 0;
-  while (i < n_constraints)
+  for (i = 0; i < constraints->len; i++)
     {
-      Constraint *c;
+      Constraint *c = g_ptr_array_index (constraints, i);
 
-      c = constraints[i];
-      while (c != NULL)
-        {
-          if (!c->has_prev)
-            heads = g_slist_prepend (heads, c);
-
-          c = c->next;
-        }
+      c->applied = FALSE;
 
-      ++i;
+      if (!c->has_prev)
+        heads = g_slist_prepend (heads, c);
     }
 
   /* Now traverse the chain and apply constraints */
@@ -803,15 +982,17 @@ stack_do_window_additions (MetaStack *stack)
 
           end[i] = w->xwindow;
 
-          /* add to the main list */
+          /* add to the main list, it gets its final place once its
+           * layer is known
+           */
           stack->sorted = g_list_prepend (stack->sorted, w);
+          queue_resort_window (stack, w);
 
           ++i;
           tmp = tmp->next;
         }
 
-      stack->need_resort = TRUE; /* may not be needed as we add to top */
-      stack->need_constrain = TRUE;
+      stack->need_constraint_graph = TRUE;
       stack->need_relayer = TRUE;
     }
 
@@ -851,12 +1032,11 @@ stack_do_relayer (MetaStack *stack)
                       "Window %s moved from layer %u to %u\n",
                       w->desc, old_layer, w->layer);
 
-          stack->need_resort = TRUE;
-          stack->need_constrain = TRUE;
-          /* don't need to constrain as constraining
-           * purely operates in terms of stack_position
-           * not layer
+          /* The window's transients may have to follow it
+           * to the new layer
            */
+          queue_resort_window (stack, w);
+          stack->moved = g_list_prepend (stack->moved, w);
         }
 
       tmp = tmp->next;
@@ -872,47 +1052,105 @@ stack_do_relayer (MetaStack *stack)
 static void
 stack_do_constrain (MetaStack *stack)
 {
-  Constraint **constraints;
+  gboolean rebuilt;
 
-  /* It'd be nice if this were all faster, probably */
+  rebuilt = FALSE;
 
-  if (!stack->need_constrain)
-    return;
+  if (stack->need_constraint_graph)
+    {
+      meta_topic (META_DEBUG_STACK,
+                  "Rebuilding constraint graph\n");
 
-  meta_topic (META_DEBUG_STACK,
-              "Reapplying constraints\n");
+      build_constraints (stack);
+
+      stack->need_constraint_graph = FALSE;
+      stack->need_constrain = TRUE;
+      rebuilt = TRUE;
+    }
 
-  constraints = g_new0 (Constraint*,
-                        stack->n_positions);
+  /* Moving windows while applying constraints doesn't
+   * need the constraints to be applied again
+   */
+  stack->applying_constraints = TRUE;
 
-  create_constraints (constraints, stack->sorted);
+  if (stack->need_constrain)
+    {
+      meta_topic (META_DEBUG_STACK,
+                  "Reapplying constraints\n");
 
-  graph_constraints (constraints, stack->n_positions);
+      /* The graph was sorted by stack position when it was built. The
+       * positions may have been replaced since, by
+       * meta_stack_set_positions(), and the order in which chains are
+       * applied decides the result when they share windows.
+       */
+      if (!rebuilt)
+        g_ptr_array_sort (stack->constraints, compare_constraint_position);
 
-  apply_constraints (constraints, stack->n_positions);
+      apply_constraints (stack->constraints);
+    }
+  else if (stack->moved != NULL)
+    {
+      GPtrArray *constraints;
 
-  free_constraints (constraints, stack->n_positions);
-  g_free (constraints);
+      /* Windows that are not connected to the moved ones
+       * kept their relative order, so their constraints hold
+       */
+      constraints = get_connected_constraints (stack, stack->moved);
+
+      meta_topic (META_DEBUG_STACK,
+                  "Reapplying %u constraints of moved windows\n",
+                  constraints->len);
+
+      apply_constraints (constraints);
+      g_ptr_array_free (constraints, TRUE);
+    }
+
+  stack->applying_constraints = FALSE;
+
+  g_list_free (stack->moved);
+  stack->moved = NULL;
 
   stack->need_constrain = FALSE;
 }
 
 /**
  * Sort stack->sorted with layers having priority over stack_position.
+ *
+ * Moving a window keeps the relative order of all the other windows,
+ * so unless everything was reordered only the windows that moved or
+ * changed layer are taken out and inserted again at their place.
  */
 static void
 stack_do_resort (MetaStack *stack)
 {
-  if (!stack->need_resort)
-    return;
+  GList *tmp;
 
-  meta_topic (META_DEBUG_STACK,
-              "Sorting stack list\n");
+  if (stack->need_resort)
+    {
+      meta_topic (META_DEBUG_STACK,
+                  "Sorting stack list\n");
 
-  stack->sorted = g_list_sort (stack->sorted,
-                               (GCompareFunc) compare_window_position);
+      stack->sorted = g_list_sort (stack->sorted,
+                                   (GCompareFunc) compare_window_position);
 
-  stack->need_resort = FALSE;
+      stack->need_resort = FALSE;
+    }
+  else if (stack->unsorted != NULL)
+    {
+      meta_topic (META_DEBUG_STACK,
+                  "Reinserting %u windows into stack list\n",
+                  g_list_length (stack->unsorted));
+
+      for (tmp = stack->unsorted; tmp != NULL; tmp = tmp->next)
+        stack->sorted = g_list_remove (stack->sorted, tmp->data);
+
+      for (tmp = stack->unsorted; tmp != NULL; tmp = tmp->next)
+        stack->sorted = g_list_insert_sorted (stack->sorted, tmp->data,
+                                              (GCompareFunc) compare_window_position);
+    }
+
+  g_list_free (stack->unsorted);
+  stack->unsorted = NULL;
 }
 
 /**
@@ -935,116 +1173,305 @@ stack_ensure_sorted (MetaStack *stack)
 }
 
 /**
- * This function is used to avoid raising a window above popup
- * menus and other such things.
+ * Restacks the windows of new_stack (top to bottom) on the X server, which
+ * has them in the order of old_stack, using as few XConfigureWindow calls
+ * as we can.
  *
- * FIXME This is sort of an expensive function, should probably
- * do something to avoid it. One approach would be to reverse
- * the stacking algorithm to work by placing each window above
- * the others, and start by lowering a window to the bottom
- * (instead of the current way, which works by placing each
- * window below another and starting with a raise)
+ * The windows whose positions in old_stack form the longest increasing
+ * subsequence of new_stack already have the right order relative to each
+ * other, so only the remaining windows are moved.  Nobody else restacks
+ * managed windows, so old_stack is also what the server has; this avoids
+ * having to ask the server for the topmost managed window with XQueryTree.
  */
 static void
-raise_window_relative_to_managed_windows (MetaScreen *screen,
-                                          Window      xwindow)
+restack_windows_minimal (MetaScreen   *screen,
+                         const GArray *old_stack,
+                         const GArray *new_stack)
 {
+  const Window *old_windows = (const Window *) old_stack->data;
+  const Window *new_windows = (const Window *) new_stack->data;
+  GHashTable *old_positions;
+  Window topmost;
+  int *positions;
+  int *tails;
+  int *prev;
+  gboolean *keep;
+  int n, n_tails, n_moves, i;
+
+  n = new_stack->len;
+
+  /* Positions of the windows that still exist in the old stack */
+  old_positions = g_hash_table_new (meta_unsigned_long_hash,
+                                    meta_unsigned_long_equal);
+  topmost = None;
+
+  for (i = 0; i < (int) old_stack->len; i++)
+    {
+      /* The window is no longer known to us (probably destroyed) */
+      if (meta_display_lookup_x_window (screen->display,
+                                        old_windows[i]) == NULL)
+        continue;
 
-  Window ignored1, ignored2;
-  Window *children;
-  unsigned int n_children;
-  int i;
+      if (topmost == None)
+        topmost = old_windows[i];
+
+      g_hash_table_insert (old_positions, (gpointer) &old_windows[i],
+                           GINT_TO_POINTER (i + 1));
+    }
 
-  /* Normally XQueryTree() means "must grab server" but here
-   * we don't, since we know we won't manage any new windows
-   * or restack any windows before using the XQueryTree results.
+  positions = g_new (int, n);
+  tails = g_new (int, n);
+  prev = g_new (int, n);
+  keep = g_new0 (gboolean, n);
+
+  for (i = 0; i < n; i++)
+    {
+      positions[i] = GPOINTER_TO_INT (g_hash_table_lookup (old_positions,
+                                                           &new_windows[i])) - 1;
+    }
+
+  g_hash_table_destroy (old_positions);
+
+  /* tails[k] is the window ending the increasing subsequence of length
+   * k + 1 that has the lowest old position found so far.
    */
+  n_tails = 0;
+  for (i = 0; i < n; i++)
+    {
+      int low, high;
+
+      prev[i] = -1;
 
-  meta_error_trap_push (screen->display);
+      /* New windows always have to be moved */
+      if (positions[i] < 0)
+        continue;
 
-  XQueryTree (screen->display->xdisplay,
-              screen->xroot,
-              &ignored1, &ignored2, &children, &n_children);
+      low = 0;
+      high = n_tails;
+      while (low < high)
+        {
+          int middle = (low + high) / 2;
 
-  if (meta_error_trap_pop_with_return (screen->display) != Success)
+          if (positions[tails[middle]] < positions[i])
+            low = middle + 1;
+          else
+            high = middle;
+        }
+
+      if (low > 0)
+        prev[i] = tails[low - 1];
+
+      tails[low] = i;
+      if (low == n_tails)
+        n_tails++;
+    }
+
+  if (n_tails > 0)
     {
-      meta_topic (META_DEBUG_STACK,
-                  "Error querying root children to raise window 0x%lx\n",
-                  xwindow);
-      return;
+      for (i = tails[n_tails - 1]; i >= 0; i = prev[i])
+        keep[i] = TRUE;
     }
 
-  /* Children are in order from bottom to top. We want to
-   * find the topmost managed child, then configure
-   * our window to be above it.
+  /* Each moved window goes right below the window above it in the new
+   * stack, which is either kept in place or has already been moved.
    */
-  i = n_children - 1;
-  while (i >= 0)
+  n_moves = 0;
+  for (i = 0; i < n; i++)
     {
-      if (children[i] == xwindow)
+      XWindowChanges changes;
+
+      if (keep[i])
+        continue;
+
+      if (i > 0)
         {
-          /* Do nothing. This means we're already the topmost managed
-           * window, but it DOES NOT mean we are already just above
-           * the topmost managed window. This is important because if
-           * an override redirect window is up, and we map a new
-           * managed window, the new window is probably above the old
-           * popup by default, and we want to push it below that
-           * popup. So keep looking for a sibling managed window
-           * to be moved below.
-           */
+          meta_topic (META_DEBUG_STACK, "Placing window 0x%lx below 0x%lx\n",
+                      new_windows[i], new_windows[i - 1]);
+
+          changes.sibling = new_windows[i - 1];
+          changes.stack_mode = Below;
         }
-      else if (meta_display_lookup_x_window (screen->display,
-                                             children[i]) != NULL)
+      else if (topmost == None)
         {
-          XWindowChanges changes;
+          /* No managed window to use, just lower ourselves to the bottom
+           * to be sure we're below any override redirect windows.
+           */
+          meta_topic (META_DEBUG_STACK, "Lowering window 0x%lx to the bottom\n",
+                      new_windows[i]);
 
-          /* children[i] is the topmost managed child */
+          XLowerWindow (screen->display->xdisplay, new_windows[i]);
+          n_moves++;
+
+          continue;
+        }
+      else if (topmost != new_windows[i])
+        {
+          /* Stay below any popup menus and other override redirect
+           * windows above the managed windows.
+           */
           meta_topic (META_DEBUG_STACK,
-                      "Moving 0x%lx above topmost managed child window 0x%lx\n",
-                      xwindow, children[i]);
+                      "Moving 0x%lx above topmost managed window 0x%lx\n",
+                      new_windows[i], topmost);
 
-          changes.sibling = children[i];
+          changes.sibling = topmost;
           changes.stack_mode = Above;
+        }
+      else
+        {
+          /* Already the topmost managed window */
+          continue;
+        }
 
-          meta_error_trap_push (screen->display);
-          XConfigureWindow (screen->display->xdisplay,
-                            xwindow,
-                            CWSibling | CWStackMode,
-                            &changes);
-          meta_error_trap_pop (screen->display);
+      XConfigureWindow (screen->display->xdisplay,
+                        new_windows[i],
+                        CWSibling | CWStackMode,
+                        &changes);
+      n_moves++;
+    }
 
-          break;
-        }
+  meta_topic (META_DEBUG_STACK, "Moved %d of %d windows\n", n_moves, n);
 
-      --i;
+  g_free (positions);
+  g_free (tails);
+  g_free (prev);
+  g_free (keep);
+}
+
+static gboolean
+window_arrays_equal (const GArray *a,
+                     const GArray *b)
+{
+  if (a == NULL || b == NULL)
+    return FALSE;
+
+  if (a->len != b->len)
+    return FALSE;
+
+  return memcmp (a->data, b->data, a->len * sizeof (Window)) == 0;
+}
+
+/**
+ * Sets a window list property on the root window, unless it already
+ * holds exactly those windows.
+ */
+static void
+publish_window_list (MetaStack  *stack,
+                     Atom        property,
+                     const char *name,
+                     GArray    **last,
+                     GArray     *windows)
+{
+  if (window_arrays_equal (*last, windows))
+    {
+      meta_topic (META_DEBUG_STACK, "%s unchanged, not setting it\n", name);
+      stack->n_unchanged_properties += 1;
+      return;
     }
 
-  if (i < 0)
+  meta_topic (META_DEBUG_STACK, "Setting %s to %u windows\n",
+              name, windows->len);
+
+  XChangeProperty (stack->screen->display->xdisplay,
+                   stack->screen->xroot,
+                   property,
+                   XA_WINDOW,
+                   32, PropModeReplace,
+                   (unsigned char *)windows->data,
+                   windows->len);
+
+  if (*last == NULL)
+    *last = g_array_sized_new (FALSE, FALSE, sizeof (Window), windows->len);
+
+  g_array_set_size (*last, 0);
+  g_array_append_vals (*last, windows->data, windows->len);
+}
+
+static gboolean
+publish_client_lists_idle (gpointer data)
+{
+  MetaStack *stack;
+  GArray *stacked;
+  GList *tmp;
+
+  stack = data;
+  stack->publish_client_lists_id = 0;
+
+  /* meta_stack_thaw() syncs again and requeues us */
+  if (stack->freeze_count > 0)
+    return FALSE;
+
+  stack_ensure_sorted (stack);
+
+  /* "stacked" is in bottom-to-top order for the _NET hints */
+  stacked = g_array_sized_new (FALSE, FALSE, sizeof (Window),
+                               stack->windows->len);
+
+  tmp = g_list_last (stack->sorted);
+  while (tmp != NULL)
     {
-      /* No sibling to use, just lower ourselves to the bottom
-       * to be sure we're below any override redirect windows.
-       */
-      meta_error_trap_push (screen->display);
-      XLowerWindow (screen->display->xdisplay,
-                    xwindow);
-      meta_error_trap_pop (screen->display);
+      MetaWindow *w;
+
+      w = tmp->data;
+      g_array_append_val (stacked, w->xwindow);
+
+      tmp = tmp->prev;
     }
 
-  if (children)
-    XFree (children);
+  publish_window_list (stack,
+                       stack->screen->display->atom__NET_CLIENT_LIST,
+                       "_NET_CLIENT_LIST",
+                       &stack->last_client_list,
+                       stack->windows);
+  publish_window_list (stack,
+                       stack->screen->display->atom__NET_CLIENT_LIST_STACKING,
+                       "_NET_CLIENT_LIST_STACKING",
+                       &stack->last_client_list_stacking,
+                       stacked);
+
+  g_array_free (stacked, TRUE);
+
+  stack->n_client_list_publishes += 1;
+
+  meta_topic (META_DEBUG_STACK,
+              "Published client lists: %u publishes, %u coalesced, "
+              "%u unchanged properties skipped\n",
+              stack->n_client_list_publishes,
+              stack->n_coalesced_publishes,
+              stack->n_unchanged_properties);
+
+  return FALSE;
+}
+
+/**
+ * Queues an update of _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING.
+ * All stack changes made before the main loop goes idle are published
+ * together.
+ */
+static void
+queue_publish_client_lists (MetaStack *stack)
+{
+  if (stack->publish_client_lists_id != 0)
+    {
+      stack->n_coalesced_publishes += 1;
+      return;
+    }
+
+  stack->publish_client_lists_id =
+    g_idle_add_full (META_PRIORITY_CLIENT_LISTS,
+                     publish_client_lists_idle,
+                     stack, NULL);
 }
 
 /**
  * Order the windows on the X server to be the same as in our structure.
  * We do this using XRestackWindows if we don't know the previous order,
- * or XConfigureWindow on a few particular windows if we do and can figure
- * out the minimum set of changes.  After that, we set __NET_CLIENT_LIST
- * and __NET_CLIENT_LIST_STACKING.
+ * or XConfigureWindow on the windows that restack_windows_minimal() finds
+ * out of order if we do.  After that, we queue an update of
+ * __NET_CLIENT_LIST and __NET_CLIENT_LIST_STACKING.
  */
 static void
 stack_sync_to_server (MetaStack *stack)
 {
-  GArray *stacked;
   GArray *root_children_stacked;
   GList *tmp;
 
@@ -1056,12 +1483,9 @@ stack_sync_to_server (MetaStack *stack)
 
   stack_ensure_sorted (stack);
 
-  /* Create stacked xwindow arrays.
-   * Painfully, "stacked" is in bottom-to-top order for the
-   * _NET hints, and "root_children_stacked" is in top-to-bottom
+  /* Create the stacked xwindow array, in top-to-bottom
    * order for XRestackWindows()
    */
-  stacked = g_array_new (FALSE, FALSE, sizeof (Window));
   root_children_stacked = g_array_new (FALSE, FALSE, sizeof (Window));
 
   meta_topic (META_DEBUG_STACK, "Top to bottom: ");
@@ -1074,9 +1498,6 @@ stack_sync_to_server (MetaStack *stack)
 
       w = tmp->data;
 
-      /* remember, stacked is in reverse order (bottom to top) */
-      g_array_prepend_val (stacked, w->xwindow);
-
       /* build XRestackWindows() array from top to bottom */
       if (w->frame)
         g_array_append_val (root_children_stacked, w->frame->xwindow);
@@ -1092,9 +1513,9 @@ stack_sync_to_server (MetaStack *stack)
   meta_pop_no_msg_prefix ();
 
   /* All windows should be in some stacking order */
-  if (stacked->len != stack->windows->len)
+  if (root_children_stacked->len != stack->windows->len)
     meta_bug ("%u windows stacked, %u windows exist in stack\n",
-              stacked->len, stack->windows->len);
+              root_children_stacked->len, stack->windows->len);
 
   /* Sync to server */
 
@@ -1123,84 +1544,9 @@ stack_sync_to_server (MetaStack *stack)
        * was saved, then we may have inefficiency, but I don't think things
        * break...
        */
-      const Window *old_stack = (Window *) stack->last_root_children_stacked->data;
-      const Window *new_stack = (Window *) root_children_stacked->data;
-      const int old_len = stack->last_root_children_stacked->len;
-      const int new_len = root_children_stacked->len;
-      const Window *oldp = old_stack;
-      const Window *newp = new_stack;
-      const Window *old_end = old_stack + old_len;
-      const Window *new_end = new_stack + new_len;
-      Window last_window = None;
-
-      while (oldp != old_end &&
-             newp != new_end)
-        {
-          if (*oldp == *newp)
-            {
-              /* Stacks are the same here, move on */
-              ++oldp;
-              last_window = *newp;
-              ++newp;
-            }
-          else if (meta_display_lookup_x_window (stack->screen->display,
-                                                 *oldp) == NULL)
-            {
-              /* *oldp is no longer known to us (probably destroyed),
-               * so we can just skip it
-               */
-              ++oldp;
-            }
-          else
-            {
-              /* Move *newp below last_window */
-              if (last_window == None)
-                {
-                  meta_topic (META_DEBUG_STACK, "Using window 0x%lx as topmost (but leaving it in-place)\n", *newp);
-
-                  raise_window_relative_to_managed_windows (stack->screen,
-                                                            *newp);
-                }
-              else
-                {
-                  /* This means that if last_window is dead, but not
-                   * *newp, then we fail to restack *newp; but on
-                   * unmanaging last_window, we'll fix it up.
-                   */
-
-                  XWindowChanges changes;
-
-                  changes.sibling = last_window;
-                  changes.stack_mode = Below;
-
-                  meta_topic (META_DEBUG_STACK, "Placing window 0x%lx below 0x%lx\n",
-                              *newp, last_window);
-
-                  XConfigureWindow (stack->screen->display->xdisplay,
-                                    *newp,
-                                    CWSibling | CWStackMode,
-                                    &changes);
-                }
-
-              last_window = *newp;
-              ++newp;
-            }
-        }
-
-      if (newp != new_end)
-        {
-          /* Restack remaining windows */
-          meta_topic (META_DEBUG_STACK, "Restacking remaining %d windows\n",
-                        (int) (new_end - newp));
-          /* We need to include an already-stacked window
-           * in the restack call, so we get in the proper position
-           * with respect to it.
-           */
-          if (newp != new_stack)
-            --newp;
-          XRestackWindows (stack->screen->display->xdisplay,
-                           (Window *) newp, new_end - newp);
-        }
+      restack_windows_minimal (stack->screen,
+                               stack->last_root_children_stacked,
+                               root_children_stacked);
     }
 
   meta_error_trap_pop (stack->screen->display);
@@ -1210,23 +1556,7 @@ stack_sync_to_server (MetaStack *stack)
    */
 
   /* Sync _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING */
-
-  XChangeProperty (stack->screen->display->xdisplay,
-                   stack->screen->xroot,
-                   stack->screen->display->atom__NET_CLIENT_LIST,
-                   XA_WINDOW,
-                   32, PropModeReplace,
-                   (unsigned char *)stack->windows->data,
-                   stack->windows->len);
-  XChangeProperty (stack->screen->display->xdisplay,
-                   stack->screen->xroot,
-                   stack->screen->display->atom__NET_CLIENT_LIST_STACKING,
-                   XA_WINDOW,
-                   32, PropModeReplace,
-                   (unsigned char *)stacked->data,
-                   stacked->len);
-
-  g_array_free (stacked, TRUE);
+  queue_publish_client_lists (stack);
 
   if (stack->last_root_children_stacked)
     g_array_free (stack->last_root_children_stacked, TRUE);
@@ -1613,8 +1943,12 @@ meta_window_set_stack_position_no_sync (MetaWindow *window,
       return;
     }
 
-  window->screen->stack->need_resort = TRUE;
-  window->screen->stack->need_constrain = TRUE;
+  /* Only this window changes its order relative to the others */
+  queue_resort_window (window->screen->stack, window);
+
+  if (!window->screen->stack->applying_constraints)
+    window->screen->stack->moved = g_list_prepend (window->screen->stack->moved,
+                                                   window);
 
   if (position < window->stack_position)
     {
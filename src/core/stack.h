@@ -120,6 +120,28 @@ struct _MetaStack
    */
   gint n_positions;
 
+  /**
+   * MetaWindows whose place in the "sorted" list is out of date because
+   * their stack_position or layer changed.  Unless need_resort is set,
+   * only these are moved when the list is sorted.
+   */
+  GList *unsorted;
+
+  /**
+   * MetaWindows that moved since the stacking constraints were last
+   * applied.  Unless need_constrain is set, only the constraints
+   * connected to these windows are applied again.
+   */
+  GList *moved;
+
+  /**
+   * The stacking constraints between windows, kept until windows,
+   * layers or transiency change.  window_constraints maps each
+   * MetaWindow to the list of constraints it takes part in.
+   */
+  GPtrArray *constraints;
+  GHashTable *window_constraints;
+
   /** Is the stack in need of re-sorting? */
   unsigned int need_resort : 1;
 
@@ -134,6 +156,36 @@ struct _MetaStack
    * recalculated with respect to transiency (parent and child windows)?
    */
   unsigned int need_constrain : 1;
+
+  /** Does the graph of stacking constraints need to be rebuilt? */
+  unsigned int need_constraint_graph : 1;
+
+  /** Are the stacking constraints being applied right now? */
+  unsigned int applying_constraints : 1;
+
+  /**
+   * Idle source which publishes _NET_CLIENT_LIST and
+   * _NET_CLIENT_LIST_STACKING, so that a burst of stack changes
+   * only sets them once.  Zero if no publish is queued.
+   */
+  guint publish_client_lists_id;
+
+  /**
+   * The contents of _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING as
+   * last set on the root window, or NULL if they were never set.
+   * A property is only replaced when its new contents differ.
+   */
+  GArray *last_client_list;
+  GArray *last_client_list_stacking;
+
+  /**
+   * How many times the client lists were published, how many requests
+   * to publish them were folded into one already queued, and how many
+   * property writes were skipped because nothing had changed.
+   */
+  guint n_client_list_publishes;
+  guint n_coalesced_publishes;
+  guint n_unchanged_properties;
 };
 
 /**
@@ -82,10 +82,30 @@ typedef enum {
 
 #define NUMBER_OF_QUEUES 3
 
+/* What we need to know about a window before managing it, fetched
+ * ahead of time so that many windows can be managed without a round
+ * trip to the X server for each of them.
+ */
+typedef struct
+{
+  XWindowAttributes attrs;
+
+  /* Whether the window has a bounding shape */
+  gboolean has_shape;
+
+  /* WM_STATE of the window, if has_wm_state is set */
+  gboolean has_wm_state;
+  gulong wm_state;
+} MetaWindowPrefetch;
+
 struct _MetaWindow
 {
   MetaDisplay *display;
   MetaScreen *screen;
+  /* Link in the screen's list of managed windows */
+  GList screen_link;
+  /* Links in the window queues; see meta_window_queue() */
+  GList queue_links[NUMBER_OF_QUEUES];
   MetaWorkspace *workspace;
   Window xwindow;
   /* may be NULL! not all windows get decorated */
@@ -276,6 +296,9 @@ struct _MetaWindow
 
   /* Are we in the various queues? (Bitfield: see META_WINDOW_IS_IN_QUEUE) */
   guint is_in_queues : NUMBER_OF_QUEUES;
+  /* Which queues hold queue_links, and which of those are their urgent part */
+  guint queue_linked : NUMBER_OF_QUEUES;
+  guint queue_urgent : NUMBER_OF_QUEUES;
 
   /* Used by keybindings.c */
   guint keys_grabbed : 1;     /* normal keybindings grabbed */
@@ -322,10 +345,22 @@ struct _MetaWindow
   /* Note: can be NULL */
   GSList *struts;
 
+  /* Properties changed since they were last loaded; see
+   * meta_window_queue_property_reload().  NULL if there are none.
+   */
+  GArray *pending_props;
+
   /* XSync update counter */
   XSyncCounter sync_request_counter;
   guint sync_request_serial;
+  /* When the outstanding sync request was sent; zero if none is */
   GTimeVal sync_request_time;
+  /* When the last sync request was sent, answered or not */
+  GTimeVal sync_request_sent_time;
+  /* Moving average of the time the client takes to answer a sync
+   * request, in milliseconds; zero until it answered one
+   */
+  double sync_request_latency;
 
   /* Number of UnmapNotify that are caused by us, if
    * we get UnmapNotify with none pending then the client
@@ -418,6 +453,10 @@ MetaWindow* meta_window_new_with_attrs     (MetaDisplay *display,
                                             Window       xwindow,
                                             gboolean     must_be_viewable,
                                             XWindowAttributes *attrs);
+MetaWindow* meta_window_new_prefetched     (MetaDisplay *display,
+                                            Window       xwindow,
+                                            gboolean     must_be_viewable,
+                                            MetaWindowPrefetch *prefetch);
 void        meta_window_free               (MetaWindow  *window,
                                             guint32      timestamp);
 void        meta_window_calc_showing       (MetaWindow  *window);
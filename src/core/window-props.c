@@ -124,6 +124,185 @@ meta_window_reload_property (MetaWindow *window,
                                             initial);
 }
 
+typedef struct
+{
+  Window xwindow;
+  Atom   property;
+} MetaPendingProperty;
+
+static gboolean
+reload_pending_properties_idle (gpointer data)
+{
+  MetaDisplay *display;
+
+  display = data;
+  display->pending_props_idle = 0;
+
+  meta_display_reload_pending_properties (display);
+
+  return FALSE;
+}
+
+void
+meta_window_queue_property_reload (MetaWindow *window,
+                                   Window      xwindow,
+                                   Atom        property)
+{
+  MetaDisplay *display;
+  MetaPendingProperty pending;
+  guint i;
+
+  display = window->display;
+
+  if (!find_hooks (display, property))
+    return;
+
+  display->n_property_notifies += 1;
+
+  if (window->pending_props == NULL)
+    {
+      window->pending_props = g_array_new (FALSE, FALSE,
+                                           sizeof (MetaPendingProperty));
+      display->windows_with_pending_props =
+        g_slist_prepend (display->windows_with_pending_props, window);
+    }
+
+  for (i = 0; i < window->pending_props->len; i++)
+    {
+      MetaPendingProperty *p;
+
+      p = &g_array_index (window->pending_props, MetaPendingProperty, i);
+      if (p->xwindow == xwindow && p->property == property)
+        {
+          display->n_collapsed_property_notifies += 1;
+          break;
+        }
+    }
+
+  if (i == window->pending_props->len)
+    {
+      pending.xwindow = xwindow;
+      pending.property = property;
+      g_array_append_val (window->pending_props, pending);
+    }
+
+  /* Nothing else is waiting, so there is nothing to batch with */
+  if (XQLength (display->xdisplay) == 0)
+    {
+      meta_display_reload_pending_properties (display);
+      return;
+    }
+
+  /* In case the events we're waiting for are taken off the queue
+   * without being handled
+   */
+  if (display->pending_props_idle == 0)
+    display->pending_props_idle =
+      g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                       reload_pending_properties_idle,
+                       display, NULL);
+}
+
+void
+meta_window_cancel_property_reloads (MetaWindow *window)
+{
+  if (window->pending_props == NULL)
+    return;
+
+  window->display->windows_with_pending_props =
+    g_slist_remove (window->display->windows_with_pending_props, window);
+
+  g_array_free (window->pending_props, TRUE);
+  window->pending_props = NULL;
+}
+
+/* Reloads the pending properties which are on one X window, all
+ * with a single round trip
+ */
+static void
+reload_pending_properties_on (MetaWindow *window,
+                              GArray     *pending,
+                              Window      xwindow)
+{
+  MetaWindowPropHooks **hooks;
+  MetaPropValue *values;
+  guint i;
+  int n_values;
+
+  hooks = g_new (MetaWindowPropHooks *, pending->len);
+  values = g_new0 (MetaPropValue, pending->len);
+
+  n_values = 0;
+  for (i = 0; i < pending->len; i++)
+    {
+      MetaPendingProperty *p;
+
+      p = &g_array_index (pending, MetaPendingProperty, i);
+      if (p->xwindow != xwindow)
+        continue;
+
+      hooks[n_values] = find_hooks (window->display, p->property);
+      init_prop_value (window, hooks[n_values], &values[n_values]);
+      n_values += 1;
+    }
+
+  meta_prop_get_values (window->display, xwindow, values, n_values);
+
+  for (i = 0; i < (guint) n_values; i++)
+    reload_prop_value (window, hooks[i], &values[i], FALSE);
+
+  meta_prop_free_values (values, n_values);
+
+  g_free (values);
+  g_free (hooks);
+}
+
+void
+meta_display_reload_pending_properties (MetaDisplay *display)
+{
+  if (display->pending_props_idle != 0)
+    {
+      g_source_remove (display->pending_props_idle);
+      display->pending_props_idle = 0;
+    }
+
+  if (display->windows_with_pending_props == NULL)
+    return;
+
+  /* Take one window at a time, since a hook may unmanage another */
+  while (display->windows_with_pending_props != NULL)
+    {
+      MetaWindow *window;
+      GArray *pending;
+
+      window = display->windows_with_pending_props->data;
+      display->windows_with_pending_props =
+        g_slist_delete_link (display->windows_with_pending_props,
+                             display->windows_with_pending_props);
+
+      pending = window->pending_props;
+      window->pending_props = NULL;
+
+      /* The properties are on the client window, except for
+       * _NET_WM_USER_TIME, which may be on its user time window
+       */
+      reload_pending_properties_on (window, pending, window->xwindow);
+      if (window->user_time_window != None)
+        reload_pending_properties_on (window, pending,
+                                      window->user_time_window);
+
+      g_array_free (pending, TRUE);
+
+      display->n_property_batches += 1;
+    }
+
+  meta_verbose ("Reloaded properties: %u notifies, %u collapsed, "
+                "%u batches\n",
+                display->n_property_notifies,
+                display->n_collapsed_property_notifies,
+                display->n_property_batches);
+}
+
 void
 meta_window_load_initial_properties (MetaWindow *window)
 {
@@ -1870,11 +2049,23 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
       cursor++;
     }
   display->n_prop_hooks = cursor - table;
+
+  display->windows_with_pending_props = NULL;
+  display->pending_props_idle = 0;
+  display->n_property_notifies = 0;
+  display->n_collapsed_property_notifies = 0;
+  display->n_property_batches = 0;
 }
 
 void
 meta_display_free_window_prop_hooks (MetaDisplay *display)
 {
+  if (display->pending_props_idle != 0)
+    {
+      g_source_remove (display->pending_props_idle);
+      display->pending_props_idle = 0;
+    }
+
   g_hash_table_unref (display->prop_hooks);
   display->prop_hooks = NULL;
 
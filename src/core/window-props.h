@@ -59,6 +59,36 @@ void meta_window_reload_property_from_xwindow (MetaWindow *window,
                                                Atom        property,
                                                gboolean    initial);
 
+/**
+ * Notes that a property of a given window has changed.  The changed
+ * properties of all windows are reloaded together once no more events
+ * are queued, or before the next event which isn't a PropertyNotify,
+ * with one round trip per window.
+ *
+ * \param window    The window.
+ * \param xwindow   The X handle for the window the property is on.
+ * \param property  A single X atom.
+ */
+void meta_window_queue_property_reload (MetaWindow *window,
+                                        Window      xwindow,
+                                        Atom        property);
+
+/**
+ * Forgets the property reloads queued for a window, which is being
+ * unmanaged.
+ *
+ * \param window  The window.
+ */
+void meta_window_cancel_property_reloads (MetaWindow *window);
+
+/**
+ * Reloads the properties queued by meta_window_queue_property_reload()
+ * for all windows on a display.
+ *
+ * \param display  The display.
+ */
+void meta_display_reload_pending_properties (MetaDisplay *display);
+
 /**
  * Requests the current values for standard properties for a given
  * window from the server, and deals with them appropriately.
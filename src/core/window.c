@@ -240,11 +240,12 @@ meta_window_new (MetaDisplay *display,
   return window;
 }
 
-MetaWindow*
-meta_window_new_with_attrs (MetaDisplay       *display,
-                            Window             xwindow,
-                            gboolean           must_be_viewable,
-                            XWindowAttributes *attrs)
+static MetaWindow*
+window_new_internal (MetaDisplay        *display,
+                     Window              xwindow,
+                     gboolean            must_be_viewable,
+                     XWindowAttributes  *attrs,
+                     MetaWindowPrefetch *prefetch)
 {
   MetaWindow *window;
   MetaWorkspace *space;
@@ -293,13 +294,25 @@ meta_window_new_with_attrs (MetaDisplay       *display,
     {
       /* Only manage if WM_STATE is IconicState or NormalState */
       gulong state;
+      gboolean has_state;
 
-      /* WM_STATE isn't a cardinal, it's type WM_STATE, but is an int */
-      if (!(meta_prop_get_cardinal_with_atom_type (display, xwindow,
+      state = WithdrawnState;
+      if (prefetch != NULL)
+        {
+          has_state = prefetch->has_wm_state;
+          state = prefetch->wm_state;
+        }
+      else
+        {
+          /* WM_STATE isn't a cardinal, it's type WM_STATE, but is an int */
+          has_state =
+            meta_prop_get_cardinal_with_atom_type (display, xwindow,
                                                    display->atom_WM_STATE,
                                                    display->atom_WM_STATE,
-                                                   &state) &&
-            (state == IconicState || state == NormalState)))
+                                                   &state);
+        }
+
+      if (!(has_state && (state == IconicState || state == NormalState)))
         {
           meta_verbose ("Deciding not to manage unmapped or unviewable window 0x%lx\n", xwindow);
           meta_error_trap_pop (display);
@@ -323,7 +336,17 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   XSelectInput (display->xdisplay, xwindow, event_mask);
 
   has_shape = FALSE;
-  if (META_DISPLAY_HAS_SHAPE (display))
+  if (META_DISPLAY_HAS_SHAPE (display) && prefetch != NULL)
+    {
+      XShapeSelectInput (display->xdisplay, xwindow, ShapeNotifyMask);
+
+      /* The server is grabbed since the shape was fetched */
+      has_shape = prefetch->has_shape;
+
+      meta_topic (META_DEBUG_SHAPES,
+                  "Window has_shape = %d (prefetched)\n", has_shape);
+    }
+  else if (META_DISPLAY_HAS_SHAPE (display))
     {
       int x_bounding, y_bounding, x_clip, y_clip;
       unsigned w_bounding, h_bounding, w_clip, h_clip;
@@ -391,6 +414,9 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->sync_request_serial = 0;
   window->sync_request_time.tv_sec = 0;
   window->sync_request_time.tv_usec = 0;
+  window->sync_request_sent_time.tv_sec = 0;
+  window->sync_request_sent_time.tv_usec = 0;
+  window->sync_request_latency = 0.0;
 
   window->screen = display->screen;
 
@@ -473,6 +499,9 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->denied_focus_and_not_transient = FALSE;
   window->unmanaging = FALSE;
   window->is_in_queues = 0;
+  window->queue_linked = 0;
+  window->queue_urgent = 0;
+  memset (window->queue_links, 0, sizeof (window->queue_links));
   window->keys_grabbed = FALSE;
   window->grab_on_frame = FALSE;
   window->all_keys_grabbed = FALSE;
@@ -540,6 +569,8 @@ meta_window_new_with_attrs (MetaDisplay       *display,
 
   window->struts = NULL;
 
+  window->pending_props = NULL;
+
   window->using_net_wm_name              = FALSE;
   window->using_net_wm_visible_name      = FALSE;
   window->using_net_wm_icon_name         = FALSE;
@@ -553,6 +584,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->initial_timestamp = 0; /* not used */
 
   meta_display_register_x_window (display, &window->xwindow, window);
+  meta_screen_add_window (window->screen, window);
 
 
   /* assign the window to its group, or create a new group if needed
@@ -793,7 +825,32 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   return window;
 }
 
-/* This function should only be called from the end of meta_window_new_with_attrs () */
+MetaWindow*
+meta_window_new_with_attrs (MetaDisplay       *display,
+                            Window             xwindow,
+                            gboolean           must_be_viewable,
+                            XWindowAttributes *attrs)
+{
+  return window_new_internal (display, xwindow, must_be_viewable,
+                              attrs, NULL);
+}
+
+/**
+ * Like meta_window_new_with_attrs(), but takes the window's shape and
+ * WM_STATE from @prefetch instead of asking the X server.  The server
+ * must have been grabbed since @prefetch was filled in.
+ */
+MetaWindow*
+meta_window_new_prefetched (MetaDisplay        *display,
+                            Window              xwindow,
+                            gboolean            must_be_viewable,
+                            MetaWindowPrefetch *prefetch)
+{
+  return window_new_internal (display, xwindow, must_be_viewable,
+                              &prefetch->attrs, prefetch);
+}
+
+/* This function should only be called from the end of window_new_internal () */
 static void
 meta_window_apply_session_info (MetaWindow *window,
                                 const MetaWindowSessionInfo *info)
@@ -1043,6 +1100,7 @@ meta_window_free (MetaWindow  *window,
                                META_QUEUE_MOVE_RESIZE |
                                META_QUEUE_UPDATE_ICON);
   meta_window_free_delete_dialog (window);
+  meta_window_cancel_property_reloads (window);
 
   if (window->workspace)
     meta_workspace_remove_window (window->workspace, window);
@@ -1112,6 +1170,7 @@ meta_window_free (MetaWindow  *window,
   meta_display_ungrab_focus_window_button (window->display, window);
 
   meta_display_unregister_x_window (window->display, window->xwindow);
+  meta_screen_remove_window (window->screen, window);
 
   meta_error_trap_push (window->display);
 
@@ -1498,8 +1557,204 @@ meta_window_calc_showing (MetaWindow  *window)
   implement_showing (window, meta_window_should_be_showing (window));
 }
 
-static guint queue_idle[NUMBER_OF_QUEUES] = {0, 0, 0};
-static GSList *queue_pending[NUMBER_OF_QUEUES] = {NULL, NULL, NULL};
+/* Most windows handled between two checks of the time budget */
+#define WINDOW_QUEUE_BATCH_SIZE 16
+
+/* How long the move_resize and update_icon queues may be worked on
+ * before the idle handler yields to the main loop, in microseconds.
+ * The calc_showing queue is always emptied in one go, so that a
+ * workspace switch is never left half done on screen.
+ */
+#define WINDOW_QUEUE_BUDGET 5000
+
+struct _MetaWindowQueue
+{
+  /* Windows are linked through their queue_links.  Focused windows and
+   * windows on the active workspace go in "urgent" and are handled
+   * before the others.
+   */
+  GQueue urgent;
+  GQueue normal;
+
+  guint idle;
+  gboolean flushing;
+
+  gint64 flush_start;
+  guint flush_depth;
+
+  /* Statistics, for the debug log */
+  guint max_depth;
+  guint n_flushes;
+  gint64 max_flush_time;
+};
+
+static MetaWindowQueue window_queues[NUMBER_OF_QUEUES];
+
+#ifdef WITH_VERBOSE_MODE
+static const gchar* meta_window_queue_names[NUMBER_OF_QUEUES] =
+  {"calc_showing", "move_resize", "update_icon"};
+#endif
+
+static guint
+window_queue_length (MetaWindowQueue *queue)
+{
+  return queue->urgent.length + queue->normal.length;
+}
+
+static gboolean
+window_is_urgent (MetaWindow *window)
+{
+  MetaWorkspace *active_workspace;
+
+  if (window->has_focus)
+    return TRUE;
+
+  active_workspace = window->screen->active_workspace;
+
+  return active_workspace != NULL &&
+         meta_window_located_on_workspace (window, active_workspace);
+}
+
+static void
+window_queue_link (MetaWindow *window,
+                   guint       queuenum)
+{
+  MetaWindowQueue *queue;
+  GList *link;
+  guint depth;
+
+  if (window->queue_linked & 1<<queuenum)
+    return;
+
+  queue = &window_queues[queuenum];
+  link = &window->queue_links[queuenum];
+  link->data = window;
+
+  if (window_is_urgent (window))
+    {
+      g_queue_push_tail_link (&queue->urgent, link);
+      window->queue_urgent |= 1<<queuenum;
+    }
+  else
+    {
+      g_queue_push_tail_link (&queue->normal, link);
+      window->queue_urgent &= ~(1<<queuenum);
+    }
+
+  window->queue_linked |= 1<<queuenum;
+
+  depth = window_queue_length (queue);
+  if (depth > queue->max_depth)
+    queue->max_depth = depth;
+}
+
+static void
+window_queue_unlink (MetaWindow *window,
+                     guint       queuenum)
+{
+  MetaWindowQueue *queue;
+
+  if (!(window->queue_linked & 1<<queuenum))
+    return;
+
+  queue = &window_queues[queuenum];
+
+  if (window->queue_urgent & 1<<queuenum)
+    g_queue_unlink (&queue->urgent, &window->queue_links[queuenum]);
+  else
+    g_queue_unlink (&queue->normal, &window->queue_links[queuenum]);
+
+  window->queue_linked &= ~(1<<queuenum);
+}
+
+/* Takes up to max_windows windows to handle off a queue, urgent ones
+ * first
+ */
+static GSList *
+window_queue_take (guint queuenum,
+                   guint max_windows)
+{
+  MetaWindowQueue *queue;
+  GSList *batch;
+  guint n_windows;
+
+  queue = &window_queues[queuenum];
+  batch = NULL;
+
+  for (n_windows = 0; n_windows < max_windows; n_windows++)
+    {
+      GList *link;
+
+      link = g_queue_peek_head_link (&queue->urgent);
+      if (link == NULL)
+        link = g_queue_peek_head_link (&queue->normal);
+      if (link == NULL)
+        break;
+
+      window_queue_unlink (link->data, queuenum);
+      batch = g_slist_prepend (batch, link->data);
+    }
+
+  return g_slist_reverse (batch);
+}
+
+static void
+window_queue_begin_flush (guint queuenum)
+{
+  MetaWindowQueue *queue;
+
+  queue = &window_queues[queuenum];
+
+  queue->flushing = TRUE;
+  queue->flush_start = g_get_monotonic_time ();
+  queue->flush_depth = window_queue_length (queue);
+}
+
+/* Whether windows are left in the queue and there's time to handle them */
+static gboolean
+window_queue_continue_flush (guint queuenum)
+{
+  MetaWindowQueue *queue;
+
+  queue = &window_queues[queuenum];
+
+  return window_queue_length (queue) > 0 &&
+         g_get_monotonic_time () - queue->flush_start < WINDOW_QUEUE_BUDGET;
+}
+
+/* Returns whether the idle handler should run again */
+static gboolean
+window_queue_end_flush (guint queuenum)
+{
+  MetaWindowQueue *queue;
+  gint64 flush_time;
+  guint remaining;
+
+  queue = &window_queues[queuenum];
+
+  flush_time = g_get_monotonic_time () - queue->flush_start;
+  remaining = window_queue_length (queue);
+
+  queue->flushing = FALSE;
+  queue->n_flushes += 1;
+  if (flush_time > queue->max_flush_time)
+    queue->max_flush_time = flush_time;
+
+  meta_topic (META_DEBUG_WINDOW_STATE,
+              "Worked on the %s queue for %" G_GINT64_FORMAT " us, "
+              "%u windows were queued and %u are left; "
+              "%u flushes, deepest queue %u, longest flush %"
+              G_GINT64_FORMAT " us\n",
+              meta_window_queue_names[queuenum], flush_time,
+              queue->flush_depth, remaining, queue->n_flushes,
+              queue->max_depth, queue->max_flush_time);
+
+  if (remaining > 0)
+    return TRUE;
+
+  queue->idle = 0;
+  return FALSE;
+}
 
 static int
 stackcmp (gconstpointer a, gconstpointer b)
@@ -1514,29 +1769,15 @@ stackcmp (gconstpointer a, gconstpointer b)
                                    aw, bw);
 }
 
-static gboolean
-idle_calc_showing (gpointer data)
+static void
+calc_showing_windows (GSList *copy)
 {
   GSList *tmp;
-  GSList *copy;
   GSList *should_show;
   GSList *should_hide;
   GSList *unplaced;
   GSList *displays;
   MetaWindow *first_window;
-  guint queue_index = GPOINTER_TO_INT (data);
-
-  meta_topic (META_DEBUG_WINDOW_STATE,
-              "Clearing the calc_showing queue\n");
-
-  /* Work with a copy, for reentrancy. The allowed reentrancy isn't
-   * complete; destroying a window while we're in here would result in
-   * badness. But it's OK to queue/unqueue calc_showings.
-   */
-  copy = g_slist_copy (queue_pending[queue_index]);
-  g_slist_free (queue_pending[queue_index]);
-  queue_pending[queue_index] = NULL;
-  queue_idle[queue_index] = 0;
 
   destroying_windows_disallowed += 1;
 
@@ -1652,22 +1893,41 @@ idle_calc_showing (gpointer data)
 
   meta_display_ungrab (first_window->display);
 
-  g_slist_free (copy);
-
   g_slist_free (unplaced);
   g_slist_free (should_show);
   g_slist_free (should_hide);
   g_slist_free (displays);
 
   destroying_windows_disallowed -= 1;
-
-  return FALSE;
 }
 
-#ifdef WITH_VERBOSE_MODE
-static const gchar* meta_window_queue_names[NUMBER_OF_QUEUES] =
-  {"calc_showing", "move_resize", "update_icon"};
-#endif
+static gboolean
+idle_calc_showing (gpointer data)
+{
+  GSList *copy;
+  guint queue_index = GPOINTER_TO_INT (data);
+
+  meta_topic (META_DEBUG_WINDOW_STATE,
+              "Clearing the calc_showing queue\n");
+
+  window_queue_begin_flush (queue_index);
+
+  /* Work with a copy, for reentrancy. The allowed reentrancy isn't
+   * complete; destroying a window while we're in here would result in
+   * badness. But it's OK to queue/unqueue calc_showings.
+   *
+   * All windows are handled under a single grab, so the windows being
+   * shown and the ones being hidden change together.
+   */
+  copy = window_queue_take (queue_index, G_MAXUINT);
+  if (copy != NULL)
+    {
+      calc_showing_windows (copy);
+      g_slist_free (copy);
+    }
+
+  return window_queue_end_flush (queue_index);
+}
 
 static void
 meta_window_unqueue (MetaWindow *window, guint queuebits)
@@ -1680,6 +1940,7 @@ meta_window_unqueue (MetaWindow *window, guint queuebits)
           &&
           (window->is_in_queues & 1<<queuenum)) /* it's in the queue */
         {
+          MetaWindowQueue *queue = &window_queues[queuenum];
 
           meta_topic (META_DEBUG_WINDOW_STATE,
               "Removing %s from the %s queue\n",
@@ -1689,17 +1950,19 @@ meta_window_unqueue (MetaWindow *window, guint queuebits)
           /* Note that window may not actually be in the queue
            * because it may have been in "copy" inside the idle handler
            */
-          queue_pending[queuenum] = g_slist_remove (queue_pending[queuenum], window);
+          window_queue_unlink (window, queuenum);
           window->is_in_queues &= ~(1<<queuenum);
 
           /* Okay, so maybe we've used up all the entries in the queue.
            * In that case, we should kill the function that deals with
            * the queue, because there's nothing left for it to do.
+           * If it's running, it will notice by itself.
            */
-          if (queue_pending[queuenum] == NULL && queue_idle[queuenum] != 0)
+          if (window_queue_length (queue) == 0 && queue->idle != 0 &&
+              !queue->flushing)
             {
-              g_source_remove (queue_idle[queuenum]);
-              queue_idle[queuenum] = 0;
+              g_source_remove (queue->idle);
+              queue->idle = 0;
             }
         }
     }
@@ -1729,6 +1992,8 @@ meta_window_queue (MetaWindow *window, guint queuebits)
            * I seem to be turning into a Perl programmer.
            */
 
+          MetaWindowQueue *queue = &window_queues[queuenum];
+
           const gint window_queue_idle_priority[NUMBER_OF_QUEUES] =
             {
               G_PRIORITY_DEFAULT_IDLE,  /* CALC_SHOWING */
@@ -1753,7 +2018,7 @@ meta_window_queue (MetaWindow *window, guint queuebits)
            * point putting it in the queue.
            */
           if (window->is_in_queues & 1<<queuenum)
-            break;
+            continue;
 
           meta_topic (META_DEBUG_WINDOW_STATE,
               "Putting %s in the %s queue\n",
@@ -1769,8 +2034,8 @@ meta_window_queue (MetaWindow *window, guint queuebits)
            * that. If not, we'll create one.
            */
 
-          if (queue_idle[queuenum] == 0)
-            queue_idle[queuenum] = g_idle_add_full
+          if (queue->idle == 0)
+            queue->idle = g_idle_add_full
               (
                 window_queue_idle_priority[queuenum],
                 window_queue_idle_handler[queuenum],
@@ -1778,9 +2043,10 @@ meta_window_queue (MetaWindow *window, guint queuebits)
                 NULL
               );
 
-          /* And now we actually put it on the queue. */
-          queue_pending[queuenum] = g_slist_prepend (queue_pending[queuenum],
-                                                     window);
+          /* And now we actually put it on the queue, unless it's still
+           * there because the idle handler hadn't reached it yet.
+           */
+          window_queue_link (window, queuenum);
       }
   }
 }
@@ -3290,6 +3556,7 @@ send_sync_request (MetaWindow *window)
 	      window->xwindow, False, 0, (XEvent*) &ev);
 
   g_get_current_time (&window->sync_request_time);
+  window->sync_request_sent_time = window->sync_request_time;
 }
 
 static gboolean
@@ -3862,35 +4129,37 @@ idle_move_resize (gpointer data)
 
   meta_topic (META_DEBUG_GEOMETRY, "Clearing the move_resize queue\n");
 
-  /* Work with a copy, for reentrancy. The allowed reentrancy isn't
-   * complete; destroying a window while we're in here would result in
-   * badness. But it's OK to queue/unqueue move_resizes.
-   */
-  copy = g_slist_copy (queue_pending[queue_index]);
-  g_slist_free (queue_pending[queue_index]);
-  queue_pending[queue_index] = NULL;
-  queue_idle[queue_index] = 0;
-
+  window_queue_begin_flush (queue_index);
   destroying_windows_disallowed += 1;
 
-  tmp = copy;
-  while (tmp != NULL)
+  do
     {
-      MetaWindow *window;
+      /* Work with a copy, for reentrancy. The allowed reentrancy isn't
+       * complete; destroying a window while we're in here would result in
+       * badness. But it's OK to queue/unqueue move_resizes.
+       */
+      copy = window_queue_take (queue_index, WINDOW_QUEUE_BATCH_SIZE);
 
-      window = tmp->data;
+      tmp = copy;
+      while (tmp != NULL)
+        {
+          MetaWindow *window;
 
-      /* As a side effect, sets window->move_resize_queued = FALSE */
-      meta_window_move_resize_now (window);
+          window = tmp->data;
 
-      tmp = tmp->next;
-    }
+          /* As a side effect, sets window->move_resize_queued = FALSE */
+          meta_window_move_resize_now (window);
 
-  g_slist_free (copy);
+          tmp = tmp->next;
+        }
+
+      g_slist_free (copy);
+    }
+  while (window_queue_continue_flush (queue_index));
 
   destroying_windows_disallowed -= 1;
 
-  return FALSE;
+  return window_queue_end_flush (queue_index);
 }
 
 void
@@ -5750,7 +6019,7 @@ process_property_notify (MetaWindow     *window,
       xid = window->user_time_window;
     }
 
-  meta_window_reload_property_from_xwindow (window, xid, event->atom, FALSE);
+  meta_window_queue_property_reload (window, xid, event->atom);
 
   return TRUE;
 }
@@ -5999,35 +6268,37 @@ idle_update_icon (gpointer data)
 
   meta_topic (META_DEBUG_GEOMETRY, "Clearing the update_icon queue\n");
 
-  /* Work with a copy, for reentrancy. The allowed reentrancy isn't
-   * complete; destroying a window while we're in here would result in
-   * badness. But it's OK to queue/unqueue update_icons.
-   */
-  copy = g_slist_copy (queue_pending[queue_index]);
-  g_slist_free (queue_pending[queue_index]);
-  queue_pending[queue_index] = NULL;
-  queue_idle[queue_index] = 0;
-
+  window_queue_begin_flush (queue_index);
   destroying_windows_disallowed += 1;
 
-  tmp = copy;
-  while (tmp != NULL)
+  do
     {
-      MetaWindow *window;
+      /* Work with a copy, for reentrancy. The allowed reentrancy isn't
+       * complete; destroying a window while we're in here would result in
+       * badness. But it's OK to queue/unqueue update_icons.
+       */
+      copy = window_queue_take (queue_index, WINDOW_QUEUE_BATCH_SIZE);
 
-      window = tmp->data;
+      tmp = copy;
+      while (tmp != NULL)
+        {
+          MetaWindow *window;
 
-      meta_window_update_icon_now (window);
-      window->is_in_queues &= ~META_QUEUE_UPDATE_ICON;
+          window = tmp->data;
 
-      tmp = tmp->next;
-    }
+          meta_window_update_icon_now (window);
+          window->is_in_queues &= ~META_QUEUE_UPDATE_ICON;
 
-  g_slist_free (copy);
+          tmp = tmp->next;
+        }
+
+      g_slist_free (copy);
+    }
+  while (window_queue_continue_flush (queue_index));
 
   destroying_windows_disallowed -= 1;
 
-  return FALSE;
+  return window_queue_end_flush (queue_index);
 }
 
 GList*
@@ -6959,6 +7230,13 @@ meta_window_titlebar_is_onscreen (MetaWindow *window)
   return is_onscreen;
 }
 
+/* How long to wait for a sync request to be answered before resizing
+ * without it, as a multiple of the client's usual latency and bounds
+ */
+#define SYNC_REQUEST_TIMEOUT_FACTOR 4.0
+#define SYNC_REQUEST_MIN_TIMEOUT_MS 100.0
+#define SYNC_REQUEST_MAX_TIMEOUT_MS 1000.0
+
 static double
 timeval_to_ms (const GTimeVal *timeval)
 {
@@ -6975,6 +7253,53 @@ time_diff (const GTimeVal *first,
   return first_ms - second_ms;
 }
 
+static double
+sync_request_timeout (MetaWindow *window)
+{
+  if (window->sync_request_latency == 0.0)
+    return SYNC_REQUEST_MAX_TIMEOUT_MS;
+
+  return CLAMP (window->sync_request_latency * SYNC_REQUEST_TIMEOUT_FACTOR,
+                SYNC_REQUEST_MIN_TIMEOUT_MS,
+                SYNC_REQUEST_MAX_TIMEOUT_MS);
+}
+
+/* How often a syncing client can take a new configure: as often as it
+ * usually answers sync requests. Until it has answered one, there's
+ * nothing to go by and it isn't held back.
+ */
+static double
+sync_request_interval (MetaWindow *window)
+{
+  return window->sync_request_latency;
+}
+
+static void
+record_sync_request_latency (MetaWindow *window)
+{
+  GTimeVal current_time;
+  double latency;
+
+  if (window->sync_request_time.tv_sec == 0 &&
+      window->sync_request_time.tv_usec == 0)
+    return;
+
+  g_get_current_time (&current_time);
+  latency = time_diff (&current_time, &window->sync_request_time);
+
+  if (window->sync_request_latency == 0.0)
+    window->sync_request_latency = latency;
+  else
+    window->sync_request_latency += (latency - window->sync_request_latency) / 4;
+
+  meta_topic (META_DEBUG_RESIZING,
+              "%s answered sync request %u after %g ms "
+              "(average %g ms, next timeout %g ms)\n",
+              window->desc, window->sync_request_serial, latency,
+              window->sync_request_latency,
+              sync_request_timeout (window));
+}
+
 static gboolean
 check_moveresize_frequency (MetaWindow *window,
 			    gdouble    *remaining)
@@ -6991,31 +7316,52 @@ check_moveresize_frequency (MetaWindow *window,
 	{
 	  double elapsed =
 	    time_diff (&current_time, &window->sync_request_time);
+	  double timeout = sync_request_timeout (window);
 
-	  if (elapsed < 1000.0)
+	  if (elapsed < timeout)
 	    {
 	      /* We want to be sure that the timeout happens at
 	       * a time where elapsed will definitely be
-	       * greater than 1000, so we can disable sync
+	       * greater than the timeout, so we can disable sync
 	       */
 	      if (remaining)
-		*remaining = 1000.0 - elapsed + 100;
+		*remaining = timeout - elapsed + 10;
 
 	      return FALSE;
 	    }
 	  else
 	    {
-	      /* We have now waited for more than a second for the
-	       * application to respond to the sync request
+	      /* The application is much slower than usual to respond
+	       * to the sync request; resize without waiting for it
+	       * until it answers.
 	       */
+	      meta_topic (META_DEBUG_RESIZING,
+			  "%s didn't answer sync request in %g ms, "
+			  "resizing without sync\n",
+			  window->desc, elapsed);
+
 	      window->disable_sync = TRUE;
 	      return TRUE;
 	    }
 	}
       else
 	{
-	  /* No outstanding sync requests. Go ahead and resize
+	  /* No outstanding sync requests.  Go ahead and resize,
+	   * unless the client answered faster than it usually does;
+	   * then wait for its usual frame time to pass.
 	   */
+	  double elapsed =
+	    time_diff (&current_time, &window->sync_request_sent_time);
+	  double interval = sync_request_interval (window);
+
+	  if (elapsed >= 0.0 && elapsed < interval)
+	    {
+	      if (remaining)
+		*remaining = interval - elapsed;
+
+	      return FALSE;
+	    }
+
 	  return TRUE;
 	}
     }
@@ -7529,83 +7875,6 @@ update_resize (MetaWindow *window,
     g_get_current_time (&window->display->grab_last_moveresize_time);
 }
 
-typedef struct
-{
-  const XEvent *current_event;
-  int           count;
-  guint32       last_time;
-} EventScannerData;
-
-static Bool
-find_last_time_predicate (Display  *display,
-                          XEvent   *xevent,
-                          XPointer  arg)
-{
-  EventScannerData *esd = (void*) arg;
-
-  if (esd->current_event->type == xevent->type &&
-      esd->current_event->xany.window == xevent->xany.window)
-    {
-      esd->count += 1;
-      esd->last_time = xevent->xmotion.time;
-    }
-
-  return False;
-}
-
-static gboolean
-check_use_this_motion_notify (MetaWindow *window,
-                              XEvent     *event)
-{
-  EventScannerData esd;
-  XEvent useless;
-
-  /* This code is copied from Owen's GDK code. */
-
-  if (window->display->grab_motion_notify_time != 0)
-    {
-      /* == is really the right test, but I'm all for paranoia */
-      if (window->display->grab_motion_notify_time <=
-          event->xmotion.time)
-        {
-          meta_topic (META_DEBUG_RESIZING,
-                      "Arrived at event with time %u (waiting for %u), using it\n",
-                      (unsigned int)event->xmotion.time,
-                      window->display->grab_motion_notify_time);
-          window->display->grab_motion_notify_time = 0;
-          return TRUE;
-        }
-      else
-        return FALSE; /* haven't reached the saved timestamp yet */
-    }
-
-  esd.current_event = event;
-  esd.count = 0;
-  esd.last_time = 0;
-
-  /* "useless" isn't filled in because the predicate never returns True */
-  XCheckIfEvent (window->display->xdisplay,
-                 &useless,
-                 find_last_time_predicate,
-                 (XPointer) &esd);
-
-  if (esd.count > 0)
-    meta_topic (META_DEBUG_RESIZING,
-                "Will skip %d motion events and use the event with time %u\n",
-                esd.count, (unsigned int) esd.last_time);
-
-  if (esd.last_time == 0)
-    return TRUE;
-  else
-    {
-      /* Save this timestamp, and ignore all motion notify
-       * until we get to the one with this stamp.
-       */
-      window->display->grab_motion_notify_time = esd.last_time;
-      return FALSE;
-    }
-}
-
 static void
 update_tile_mode (MetaWindow *window)
 {
@@ -7632,6 +7901,8 @@ meta_window_handle_mouse_grab_op_event (MetaWindow *window,
                   window->display->grab_latest_motion_x,
                   window->display->grab_latest_motion_y);
 
+      record_sync_request_latency (window);
+
       /* If sync was previously disabled, turn it back on and hope
        * the application has come to its senses (maybe it was just
        * busy with a pagefault or a long computation).
@@ -7640,6 +7911,15 @@ meta_window_handle_mouse_grab_op_event (MetaWindow *window,
       window->sync_request_time.tv_sec = 0;
       window->sync_request_time.tv_usec = 0;
 
+      /* The compensation event was set for the answer not coming;
+       * schedule a new one for the client's next frame if needed.
+       */
+      if (window->display->grab_resize_timeout_id)
+        {
+          g_source_remove (window->display->grab_resize_timeout_id);
+          window->display->grab_resize_timeout_id = 0;
+        }
+
       /* This means we are ready for another configure. */
       switch (window->display->grab_op)
         {
@@ -7659,12 +7939,14 @@ meta_window_handle_mouse_grab_op_event (MetaWindow *window,
         case META_GRAB_OP_KEYBOARD_RESIZING_NE:
         case META_GRAB_OP_KEYBOARD_RESIZING_SW:
         case META_GRAB_OP_KEYBOARD_RESIZING_NW:
-          /* no pointer round trip here, to keep in sync */
+          /* no pointer round trip here, to keep in sync; this waits
+           * for the client's next frame if it answered early
+           */
           update_resize (window,
                          window->display->grab_last_user_action_was_snap,
                          window->display->grab_latest_motion_x,
                          window->display->grab_latest_motion_y,
-                         TRUE);
+                         FALSE);
           break;
 
         case META_GRAB_OP_NONE:
@@ -7758,27 +8040,19 @@ meta_window_handle_mouse_grab_op_event (MetaWindow *window,
       if (meta_grab_op_is_moving (window->display->grab_op))
         {
           if (event->xmotion.root == window->screen->xroot)
-            {
-              if (check_use_this_motion_notify (window,
-                                                event))
-                update_move (window,
-                             event->xmotion.state & ShiftMask,
-                             event->xmotion.x_root,
-                             event->xmotion.y_root);
-            }
+            update_move (window,
+                         event->xmotion.state & ShiftMask,
+                         event->xmotion.x_root,
+                         event->xmotion.y_root);
         }
       else if (meta_grab_op_is_resizing (window->display->grab_op))
         {
           if (event->xmotion.root == window->screen->xroot)
-            {
-              if (check_use_this_motion_notify (window,
-                                                event))
-                update_resize (window,
-                               event->xmotion.state & ShiftMask,
-                               event->xmotion.x_root,
-                               event->xmotion.y_root,
-                               FALSE);
-            }
+            update_resize (window,
+                           event->xmotion.state & ShiftMask,
+                           event->xmotion.x_root,
+                           event->xmotion.y_root,
+                           FALSE);
         }
       break;
 
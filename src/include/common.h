@@ -202,6 +202,7 @@ typedef enum
 
 #define META_DEFAULT_ICON_NAME "window"
 
+#define META_PRIORITY_CLIENT_LISTS  (G_PRIORITY_DEFAULT_IDLE + 5)
 #define META_PRIORITY_PREFS_NOTIFY   (G_PRIORITY_DEFAULT_IDLE + 10)
 #define META_PRIORITY_WORK_AREA_HINT (G_PRIORITY_DEFAULT_IDLE + 15)
 
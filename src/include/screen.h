@@ -22,6 +22,7 @@
 
 #include <X11/Xlib.h>
 #include <glib.h>
+#include "boxes.h"
 #include "types.h"
 
 int meta_screen_get_screen_number (MetaScreen *screen);
@@ -32,6 +33,11 @@ void meta_screen_get_size (MetaScreen *screen,
                            int        *width,
                            int        *height);
 
+int meta_screen_get_n_xineramas (MetaScreen *screen);
+void meta_screen_get_xinerama_geometry (MetaScreen    *screen,
+                                        int            xinerama,
+                                        MetaRectangle *geometry);
+
 gpointer meta_screen_get_compositor_data (MetaScreen *screen);
 void meta_screen_set_compositor_data (MetaScreen *screen,
                                       gpointer    info);
@@ -40,6 +40,9 @@
 
 #define DEFAULT_INNER_BUTTON_BORDER 3
 
+/* Rendered frames are kept, oldest first out, within this many bytes */
+#define MAX_CACHED_PIXELS_SIZE (16 * 1024 * 1024)
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846264338327
 #endif
@@ -96,11 +99,55 @@ struct _MetaFrames
 
   gint         expose_delay_count;
 
-  gint         invalidate_cache_timeout_id;
-  GList       *invalidate_frames;
+  /* Rendered frames, shared by all frames which look the same:
+   * CachedFrameKey -> CachedPixels
+   */
   GHashTable  *cache;
+  /* The same, most recently used first */
+  GQueue       cached_pixels;
+  gsize        cached_size;
+  /* The theme the frames were rendered with */
+  MetaTheme   *cache_theme;
 };
 
+typedef struct
+{
+  cairo_rectangle_int_t rect;
+  cairo_surface_t *pixmap;
+} CachedFramePiece;
+
+/* Everything that goes into rendering a frame */
+typedef struct
+{
+  gchar            *theme_variant;
+  MetaFrameType     type;
+  MetaFrameFlags    flags;
+  int               width;
+  int               height;
+  int               scale;
+  gchar            *title;
+  GdkPixbuf        *mini_icon;
+  GdkPixbuf        *icon;
+  MetaFrameControl  prelit_control;
+  MetaGrabOp        grab_op;
+} CachedFrameKey;
+
+typedef struct
+{
+  CachedFrameKey key;
+
+  /* Link in MetaFrames.cached_pixels */
+  GList link;
+
+  /* Bytes used by the pieces */
+  gsize size;
+
+  /* Caches of the four rendered sides in a MetaFrame.
+   * Order: top (titlebar), left, right, bottom.
+   */
+  CachedFramePiece piece[4];
+} CachedPixels;
+
 G_DEFINE_TYPE (MetaFrames, meta_frames, GTK_TYPE_WINDOW)
 
 static void
@@ -416,6 +463,43 @@ unsigned_long_hash (gconstpointer v)
 #endif
 }
 
+static guint
+cached_frame_key_hash (gconstpointer v)
+{
+  const CachedFrameKey *key = v;
+  guint hash;
+
+  hash = key->width * 31 + key->height;
+  hash = hash * 31 + key->type;
+  hash = hash * 31 + key->flags;
+  hash = hash * 31 + key->prelit_control;
+
+  if (key->title)
+    hash ^= g_str_hash (key->title);
+
+  return hash;
+}
+
+static gboolean
+cached_frame_key_equal (gconstpointer v1,
+                        gconstpointer v2)
+{
+  const CachedFrameKey *key1 = v1;
+  const CachedFrameKey *key2 = v2;
+
+  return key1->type == key2->type &&
+         key1->flags == key2->flags &&
+         key1->width == key2->width &&
+         key1->height == key2->height &&
+         key1->scale == key2->scale &&
+         key1->mini_icon == key2->mini_icon &&
+         key1->icon == key2->icon &&
+         key1->prelit_control == key2->prelit_control &&
+         key1->grab_op == key2->grab_op &&
+         g_strcmp0 (key1->theme_variant, key2->theme_variant) == 0 &&
+         g_strcmp0 (key1->title, key2->title) == 0;
+}
+
 static void
 prefs_changed_callback (MetaPreference pref,
                         void          *data)
@@ -443,9 +527,11 @@ meta_frames_init (MetaFrames *frames)
 
   frames->expose_delay_count = 0;
 
-  frames->invalidate_cache_timeout_id = 0;
-  frames->invalidate_frames = NULL;
-  frames->cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+  frames->cache = g_hash_table_new (cached_frame_key_hash,
+                                    cached_frame_key_equal);
+  g_queue_init (&frames->cached_pixels);
+  frames->cached_size = 0;
+  frames->cache_theme = NULL;
 
   meta_prefs_add_listener (prefs_changed_callback, frames);
 }
@@ -497,8 +583,7 @@ meta_frames_finalize (GObject *object)
   meta_prefs_remove_listener (prefs_changed_callback, frames);
 
   invalidate_all_caches (frames);
-  if (frames->invalidate_cache_timeout_id)
-    g_source_remove (frames->invalidate_cache_timeout_id);
+  g_clear_object (&frames->cache_theme);
 
   g_assert (g_hash_table_size (frames->frames) == 0);
   g_hash_table_destroy (frames->frames);
@@ -507,76 +592,39 @@ meta_frames_finalize (GObject *object)
   G_OBJECT_CLASS (meta_frames_parent_class)->finalize (object);
 }
 
-typedef struct
-{
-  cairo_rectangle_int_t rect;
-  cairo_surface_t *pixmap;
-} CachedFramePiece;
-
-typedef struct
-{
-  /* Caches of the four rendered sides in a MetaFrame.
-   * Order: top (titlebar), left, right, bottom.
-   */
-  CachedFramePiece piece[4];
-} CachedPixels;
-
-static CachedPixels *
-get_cache (MetaFrames *frames,
-           MetaUIFrame *frame)
-{
-  CachedPixels *pixels;
-
-  pixels = g_hash_table_lookup (frames->cache, frame);
-
-  if (!pixels)
-    {
-      pixels = g_new0 (CachedPixels, 1);
-      g_hash_table_insert (frames->cache, frame, pixels);
-    }
-
-  return pixels;
-}
-
 static void
-invalidate_cache (MetaFrames *frames,
-                  MetaUIFrame *frame)
+drop_cached_pixels (MetaFrames   *frames,
+                    CachedPixels *pixels)
 {
-  CachedPixels *pixels = get_cache (frames, frame);
   int i;
 
+  g_hash_table_remove (frames->cache, &pixels->key);
+  g_queue_unlink (&frames->cached_pixels, &pixels->link);
+  frames->cached_size -= pixels->size;
+
   for (i = 0; i < 4; i++)
     if (pixels->piece[i].pixmap)
       cairo_surface_destroy (pixels->piece[i].pixmap);
 
+  g_free (pixels->key.theme_variant);
+  g_free (pixels->key.title);
+
+  if (pixels->key.mini_icon)
+    g_object_unref (pixels->key.mini_icon);
+
+  if (pixels->key.icon)
+    g_object_unref (pixels->key.icon);
+
   g_free (pixels);
-  g_hash_table_remove (frames->cache, frame);
 }
 
 static void
 invalidate_all_caches (MetaFrames *frames)
 {
-  GList *l;
-
-  for (l = frames->invalidate_frames; l; l = l->next)
-    {
-      MetaUIFrame *frame = l->data;
+  while (frames->cached_pixels.head != NULL)
+    drop_cached_pixels (frames, frames->cached_pixels.head->data);
 
-      invalidate_cache (frames, frame);
-    }
-
-  g_list_free (frames->invalidate_frames);
-  frames->invalidate_frames = NULL;
-}
-
-static gboolean
-invalidate_cache_timeout (gpointer data)
-{
-  MetaFrames *frames = data;
-
-  invalidate_all_caches (frames);
-  frames->invalidate_cache_timeout_id = 0;
-  return FALSE;
+  g_assert (frames->cached_size == 0);
 }
 
 static void
@@ -603,6 +651,8 @@ meta_frames_font_changed (MetaFrames *frames)
 
   meta_theme_set_titlebar_font (theme, titlebar_font);
 
+  invalidate_all_caches (frames);
+
   /* Queue a draw/resize on all frames */
   g_hash_table_foreach (frames->frames,
                         queue_recalc_func, frames);
@@ -624,6 +674,8 @@ queue_draw_func (gpointer key, gpointer value, gpointer data)
 static void
 meta_frames_button_layout_changed (MetaFrames *frames)
 {
+  invalidate_all_caches (frames);
+
   g_hash_table_foreach (frames->frames,
                         queue_draw_func, frames);
 }
@@ -655,6 +707,8 @@ meta_frames_style_updated (GtkWidget *widget)
   meta_theme_set_composited (theme, compositing_manager);
   meta_theme_invalidate (theme);
 
+  invalidate_all_caches (frames);
+
   meta_frames_font_changed (frames);
 
   g_hash_table_foreach (frames->frames,
@@ -796,11 +850,6 @@ meta_frames_unmanage_window (MetaFrames *frames,
 
   if (frame)
     {
-      /* invalidating all caches ensures the frame
-       * is not actually referenced anymore
-       */
-      invalidate_all_caches (frames);
-
       /* restore the cursor */
       meta_core_set_screen_cursor (frames->xdisplay, frame->xwindow,
                                    META_CURSOR_DEFAULT);
@@ -1443,7 +1492,6 @@ redraw_control (MetaFrames       *frames,
     return;
 
   gdk_window_invalidate_rect (frame->window, &rect, FALSE);
-  invalidate_cache (frames, frame);
 }
 
 static void
@@ -2229,8 +2277,8 @@ meta_frames_motion_notify_event     (GtkWidget           *widget,
 */
 
 static cairo_surface_t *
-generate_pixmap (MetaFrames            *frames,
-                 MetaUIFrame           *frame,
+generate_pixmap (MetaUIFrame           *frame,
+                 cairo_surface_t       *recording,
                  cairo_rectangle_int_t *rect)
 {
   cairo_surface_t *result;
@@ -2249,23 +2297,28 @@ generate_pixmap (MetaFrames            *frames,
 
   cairo_paint (cr);
 
-  meta_frames_paint (frames, frame, cr);
+  cairo_set_source_surface (cr, recording, 0, 0);
+  cairo_paint (cr);
 
   cairo_destroy (cr);
 
   return result;
 }
 
-static void
-populate_cache (MetaFrames *frames,
-                MetaUIFrame *frame)
+/* Returns the rendered frame, which may be shared with other frames
+ * that look the same, or NULL if it shouldn't be cached.
+ */
+static CachedPixels *
+get_cached_pixels (MetaFrames  *frames,
+                   MetaUIFrame *frame)
 {
   MetaFrameBorders borders;
   int width, height;
   int frame_width, frame_height, screen_width, screen_height;
+  CachedFrameKey key;
   CachedPixels *pixels;
-  MetaFrameType frame_type;
-  MetaFrameFlags frame_flags;
+  cairo_surface_t *recording;
+  cairo_t *cr;
   int i;
 
   meta_core_get (frames->xdisplay, frame->xwindow,
@@ -2275,21 +2328,62 @@ populate_cache (MetaFrames *frames,
                  META_CORE_GET_SCREEN_HEIGHT, &screen_height,
                  META_CORE_GET_CLIENT_WIDTH, &width,
                  META_CORE_GET_CLIENT_HEIGHT, &height,
-                 META_CORE_GET_FRAME_TYPE, &frame_type,
-                 META_CORE_GET_FRAME_FLAGS, &frame_flags,
+                 META_CORE_GET_FRAME_TYPE, &key.type,
+                 META_CORE_GET_FRAME_FLAGS, &key.flags,
+                 META_CORE_GET_MINI_ICON, &key.mini_icon,
+                 META_CORE_GET_ICON, &key.icon,
                  META_CORE_GET_END);
 
   /* don't cache extremely large windows */
   if (frame_width > 2 * screen_width ||
       frame_height > 2 * screen_height)
     {
-      return;
+      return NULL;
+    }
+
+  if (frames->cache_theme != meta_ui_get_theme ())
+    {
+      invalidate_all_caches (frames);
+      g_set_object (&frames->cache_theme, meta_ui_get_theme ());
+    }
+
+  key.theme_variant = frame->theme_variant;
+  key.width = width;
+  key.height = height;
+  key.scale = gdk_window_get_scale_factor (frame->window);
+  key.title = frame->title;
+  key.prelit_control = frame->prelit_control;
+
+  /* The states of the buttons follow from these */
+  if (meta_core_get_grab_frame (frames->xdisplay) == frame->xwindow)
+    key.grab_op = meta_core_get_grab_op (frames->xdisplay);
+  else
+    key.grab_op = META_GRAB_OP_NONE;
+
+  pixels = g_hash_table_lookup (frames->cache, &key);
+
+  if (pixels != NULL)
+    {
+      g_queue_unlink (&frames->cached_pixels, &pixels->link);
+      g_queue_push_head_link (&frames->cached_pixels, &pixels->link);
+
+      return pixels;
     }
 
   meta_theme_get_frame_borders (meta_ui_get_theme (), frame->theme_variant,
-                                frame_type, frame_flags, &borders);
+                                key.type, key.flags, &borders);
+
+  pixels = g_new0 (CachedPixels, 1);
+
+  pixels->key = key;
+  pixels->key.theme_variant = g_strdup (key.theme_variant);
+  pixels->key.title = g_strdup (key.title);
+
+  if (key.mini_icon)
+    g_object_ref (key.mini_icon);
 
-  pixels = get_cache (frames, frame);
+  if (key.icon)
+    g_object_ref (key.icon);
 
   /* Setup the rectangles for the four visible frame borders. First top, then
    * left, right and bottom. Top and bottom extend to the invisible borders
@@ -2328,21 +2422,37 @@ populate_cache (MetaFrames *frames,
                                 borders.visible.right + borders.shadow.right;
   pixels->piece[3].rect.height = borders.visible.bottom + borders.shadow.bottom;
 
+  /* Go through the theme once, and only rasterize the pieces */
+  recording = cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA, NULL);
+
+  cr = cairo_create (recording);
+  meta_frames_paint (frames, frame, cr);
+  cairo_destroy (cr);
+
   for (i = 0; i < 4; i++)
     {
       CachedFramePiece *piece = &pixels->piece[i];
-      if (!piece->pixmap)
-        piece->pixmap = generate_pixmap (frames, frame, &piece->rect);
+
+      piece->pixmap = generate_pixmap (frame, recording, &piece->rect);
+      if (piece->pixmap)
+        pixels->size += (gsize) piece->rect.width * piece->rect.height *
+                        key.scale * key.scale * 4;
     }
 
-  if (frames->invalidate_cache_timeout_id)
-    g_source_remove (frames->invalidate_cache_timeout_id);
+  cairo_surface_destroy (recording);
+
+  g_hash_table_insert (frames->cache, &pixels->key, pixels);
 
-  frames->invalidate_cache_timeout_id = g_timeout_add (1000, invalidate_cache_timeout, frames);
+  pixels->link.data = pixels;
+  g_queue_push_head_link (&frames->cached_pixels, &pixels->link);
+  frames->cached_size += pixels->size;
 
-  if (!g_list_find (frames->invalidate_frames, frame))
-    frames->invalidate_frames =
-      g_list_prepend (frames->invalidate_frames, frame);
+  /* Evict the frames that haven't been drawn for the longest time */
+  while (frames->cached_size > MAX_CACHED_PIXELS_SIZE &&
+         frames->cached_pixels.length > 1)
+    drop_cached_pixels (frames, frames->cached_pixels.tail->data);
+
+  return pixels;
 }
 
 static void
@@ -2464,12 +2574,11 @@ meta_frames_draw (GtkWidget *widget,
       return TRUE;
     }
 
-  populate_cache (frames, frame);
-
-  pixels = get_cache (frames, frame);
+  pixels = get_cached_pixels (frames, frame);
   region = cairo_region_create_rectangle (&clip);
 
-  cached_pixels_draw (pixels, cr, region);
+  if (pixels != NULL)
+    cached_pixels_draw (pixels, cr, region);
 
   subtract_client_area (region, frames->xdisplay, frame);
 
@@ -2773,5 +2882,4 @@ invalidate_whole_window (MetaFrames *frames,
                          MetaUIFrame *frame)
 {
   gdk_window_invalidate_rect (frame->window, NULL, FALSE);
-  invalidate_cache (frames, frame);
 }
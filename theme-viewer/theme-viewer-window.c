@@ -70,6 +70,8 @@ struct _ThemeViewerWindow
   GtkWidget        *load_time;
   GtkWidget        *get_borders_time;
   GtkWidget        *draw_time;
+  GtkWidget        *evaluate_time;
+  GtkWidget        *title_layouts;
 
   GtkWidget        *benchmark_button;
 };
@@ -196,8 +198,6 @@ benchmark_draw_time (ThemeViewerWindow *window,
   end = clock ();
   g_timer_stop (timer);
 
-  g_object_unref (theme);
-
   elapsed = end - start;
   seconds = (gdouble) elapsed / CLOCKS_PER_SEC;
   wall_seconds = g_timer_elapsed (timer, NULL);
@@ -214,6 +214,100 @@ benchmark_draw_time (ThemeViewerWindow *window,
   g_free (message);
 }
 
+static void
+benchmark_evaluate_time (ThemeViewerWindow *window,
+                         MetaTheme         *theme,
+                         MetaFrameBorders  *borders)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  clock_t start;
+  clock_t end;
+  clock_t elapsed;
+  gdouble seconds;
+  gchar *message;
+  gint client_width;
+  gint client_height;
+  gint inc;
+  gint i;
+
+  /* Everything drawn is clipped away, so this measures what the theme
+   * does to lay out and evaluate each frame rather than rendering.
+   */
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 1, 1);
+  cr = cairo_create (surface);
+
+  cairo_rectangle (cr, 0, 0, 0, 0);
+  cairo_clip (cr);
+
+  client_width = 200;
+  client_height = 120;
+  inc = 1000 / BENCHMARK_ITERATIONS;
+
+  start = clock ();
+
+  for (i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+      gint width;
+      gint height;
+
+      width = client_width + borders->total.left + borders->total.right;
+      height = client_height + borders->total.top + borders->total.bottom;
+
+      cairo_save (cr);
+      meta_theme_draw_frame (theme, window->theme_variant, cr,
+                             window->frame_type, window->frame_flags,
+                             width, height, "Benchmark",
+                             NULL, NULL, window->mini_icon, window->icon);
+      cairo_restore (cr);
+
+      client_width += inc;
+      client_height += inc;
+    }
+
+  end = clock ();
+
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+
+  elapsed = end - start;
+  seconds = (gdouble) elapsed / CLOCKS_PER_SEC;
+
+  message = g_strdup_printf (_("Evaluated <b>%d</b> frames with drawing clipped away in <b>%f</b> seconds (<b>%f</b> milliseconds per frame)."),
+                             BENCHMARK_ITERATIONS,
+                             seconds, (seconds / BENCHMARK_ITERATIONS) * 1000);
+
+  gtk_label_set_markup (GTK_LABEL (window->evaluate_time), message);
+  gtk_widget_show (window->evaluate_time);
+  g_free (message);
+}
+
+static void
+benchmark_title_layouts (ThemeViewerWindow *window,
+                         MetaTheme         *theme)
+{
+  guint hits;
+  guint misses;
+  gdouble hit_rate;
+  gchar *message;
+
+  g_object_get (theme,
+                "title-layout-hits", &hits,
+                "title-layout-misses", &misses,
+                NULL);
+
+  hit_rate = 0.0;
+  if (hits + misses > 0)
+    hit_rate = (gdouble) hits / (hits + misses) * 100;
+
+  message = g_strdup_printf (_("Reused a cached title layout for <b>%u</b> of <b>%u</b> frames (<b>%.1f%%</b> hit rate)."),
+                             hits, hits + misses, hit_rate);
+
+  gtk_label_set_markup (GTK_LABEL (window->title_layouts), message);
+  gtk_widget_show (window->title_layouts);
+  g_free (message);
+}
+
 static void
 run_benchmark (ThemeViewerWindow *window)
 {
@@ -239,6 +333,14 @@ run_benchmark (ThemeViewerWindow *window)
   /* 3. benchmark draw time */
   benchmark_draw_time (window, theme, &borders);
 
+  /* 4. benchmark frame evaluation without drawing */
+  benchmark_evaluate_time (window, theme, &borders);
+
+  /* 5. title layout reuse over the draws above */
+  benchmark_title_layouts (window, theme);
+
+  g_object_unref (theme);
+
   gtk_button_set_label (GTK_BUTTON (window->benchmark_button), _("Run again"));
   gtk_widget_set_sensitive (window->benchmark_button, TRUE);
 }
@@ -901,6 +1003,8 @@ theme_viewer_window_class_init (ThemeViewerWindowClass *window_class)
   gtk_widget_class_bind_template_child (widget_class, ThemeViewerWindow, load_time);
   gtk_widget_class_bind_template_child (widget_class, ThemeViewerWindow, get_borders_time);
   gtk_widget_class_bind_template_child (widget_class, ThemeViewerWindow, draw_time);
+  gtk_widget_class_bind_template_child (widget_class, ThemeViewerWindow, evaluate_time);
+  gtk_widget_class_bind_template_child (widget_class, ThemeViewerWindow, title_layouts);
 
   gtk_widget_class_bind_template_child (widget_class, ThemeViewerWindow, benchmark_button);
   gtk_widget_class_bind_template_callback (widget_class, benchmark_button_clicked_cb);
@@ -921,6 +1025,8 @@ theme_viewer_window_init (ThemeViewerWindow *window)
   gtk_label_set_xalign (GTK_LABEL (window->load_time), 0.0);
   gtk_label_set_xalign (GTK_LABEL (window->get_borders_time), 0.0);
   gtk_label_set_xalign (GTK_LABEL (window->draw_time), 0.0);
+  gtk_label_set_xalign (GTK_LABEL (window->evaluate_time), 0.0);
+  gtk_label_set_xalign (GTK_LABEL (window->title_layouts), 0.0);
 }
 
 GtkWidget *